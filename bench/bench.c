@@ -0,0 +1,224 @@
+// times the scanner, the compiler and the vm on generated sources and writes the results as json,
+// so runs of different versions can be compared.
+//   gcc -O2 -o bench/bench bench/bench.c -lm
+//   bench/bench [size in KiB] [runs] > results.json
+// every phase is repeated, the median and variance of the times are reported.
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../src/vm.h"
+#include "../src/compiler.h"
+
+#define SIZE 1024 // KiB of source per workload.
+#define RUNS 15
+#define DEEP_DEPTH 10000 // far past what fits on the c stack of a recursive parser.
+
+double now()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// the inputs every workload uses, so the compiler can not fold the expressions away.
+const char* inputNames[] = { "x", "y" };
+Value inputs[] = { 1.25, -3.5 };
+
+typedef void (*Generator)(OutputBuffer* out, size_t size);
+
+// (x + (y * (x - ( ... )))) + ..., groups nested depth deep.
+// the vm stack needs depth + 1 values, and the parser keeps depth operators pending.
+void generateNested(OutputBuffer* out, size_t size, int depth)
+{
+	const char ops[] = "+*-/";
+	for(int group = 0; out->size < size; group++)
+	{
+		if(group)
+			writeString(out, " +\n");
+		for(int i = 0; i < depth; i++)
+			writeFormat(out, "(%c %c ", i % 2 ? 'y' : 'x', ops[i % 4]);
+		writeString(out, "x");
+		for(int i = 0; i < depth; i++)
+			writeChar(out, ')');
+	}
+	writeChar(out, '\n');
+}
+
+void generateShallow(OutputBuffer* out, size_t size)
+{
+	generateNested(out, size, 64);
+}
+
+void generateDeep(OutputBuffer* out, size_t size)
+{
+	generateNested(out, size, DEEP_DEPTH);
+}
+
+// x + y + x + y ..., one long chain.
+void generateFlat(OutputBuffer* out, size_t size)
+{
+	writeChar(out, 'x');
+	for(int i = 0; out->size < size; i++)
+		writeString(out, i % 2 ? " + x" : " + y");
+	writeChar(out, '\n');
+}
+
+// x * 1.2345678e-3 + 98765.4321 * y - ..., mostly number literals.
+void generateLiterals(OutputBuffer* out, size_t size)
+{
+	writeChar(out, 'x');
+	for(int i = 0; out->size < size; i++)
+		writeFormat(out, " + %d.%06de-%d * %c", i % 1000, (i * 7919) % 1000000, i % 20, i % 2 ? 'x' : 'y');
+	writeChar(out, '\n');
+}
+
+// x + y with a line comment and a block comment around every term.
+void generateComments(OutputBuffer* out, size_t size)
+{
+	writeChar(out, 'x');
+	for(int i = 0; out->size < size; i++)
+	{
+		writeString(out, " // the running total of every term so far, kept for the report\n");
+		writeString(out, "    /* add the next measurement, which was already corrected */ + ");
+		writeChar(out, i % 2 ? 'x' : 'y');
+	}
+	writeChar(out, '\n');
+}
+
+typedef struct Workload
+{
+	const char* name;
+	Generator generate;
+} Workload;
+
+int compareTimes(const void* a, const void* b)
+{
+	double x = *(const double*)a;
+	double y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+// writes one result, amount is what the phase processes in one run (bytes or instructions).
+void report(bool* first, const char* workload, const char* phase, double* times, int runs, double amount, const char* unit)
+{
+	qsort(times, runs, sizeof(double), compareTimes);
+	double median = runs % 2 ? times[runs / 2] : (times[runs / 2 - 1] + times[runs / 2]) / 2;
+	double mean = 0;
+	for(int i = 0; i < runs; i++)
+		mean += times[i];
+	mean /= runs;
+	double variance = 0;
+	for(int i = 0; i < runs; i++)
+		variance += (times[i] - mean) * (times[i] - mean);
+	variance /= runs;
+
+	printf("%s\n    {\"workload\": \"%s\", \"phase\": \"%s\", \"runs\": %d, \"median\": %.9f, \"variance\": %.3e, "
+		"\"min\": %.9f, \"max\": %.9f, \"throughput\": %.3f, \"unit\": \"%s\"}",
+		*first ? "" : ",", workload, phase, runs, median, variance, times[0], times[runs - 1], amount / median / 1e6, unit);
+	*first = false;
+
+	fprintf(stderr, "%-9s %-8s median %9.3f ms  stddev %6.3f ms  %10.1f %s\n", workload, phase, median * 1e3,
+		variance > 0 ? sqrt(variance) * 1e3 : 0, amount / median / 1e6, unit);
+}
+
+int main(int argc, char const *argv[])
+{
+	size_t size = (argc > 1 ? (size_t)atol(argv[1]) : SIZE) * 1024;
+	int runs = argc > 2 ? atoi(argv[2]) : RUNS;
+	if(runs < 1)
+		runs = 1;
+
+	Workload workloads[] = {
+		{ "nested", generateShallow },
+		{ "deep", generateDeep },
+		{ "flat", generateFlat },
+		{ "literals", generateLiterals },
+		{ "comments", generateComments },
+	};
+	double* times = (double*)malloc(runs * sizeof(double));
+
+#ifdef THREADED_DISPATCH
+	const char* dispatch = "threaded";
+#else
+	const char* dispatch = "switch";
+#endif
+	printf("{\n  \"version\": \"%s\",\n  \"dispatch\": \"%s\",\n  \"size\": %zu,\n  \"results\": [", COMPILER_VERSION, dispatch, size);
+	bool first = true;
+
+	for(size_t w = 0; w < sizeof(workloads) / sizeof(Workload); w++)
+	{
+		OutputBuffer source;
+		initOutputBuffer(&source, NULL, size + 4096);
+		workloads[w].generate(&source, size);
+		writeChar(&source, '\0');
+		double bytes = source.size - 1;
+
+		long tokens = 0;
+		for(int r = 0; r < runs; r++)
+		{
+			Scanner scanner;
+			initScanner(&scanner, source.data);
+			double start = now();
+			tokens = 0;
+			while(scanToken(&scanner).type != TOKEN_EOF)
+				tokens++;
+			times[r] = now() - start;
+		}
+		report(&first, workloads[w].name, "scan", times, runs, bytes, "MB/s");
+
+		Chunk chunk;
+		for(int r = 0; r < runs; r++)
+		{
+			initChunk(&chunk);
+			Compiler comp;
+			initCompiler(&comp);
+			comp.inputs = inputNames;
+			comp.inputCount = 2;
+
+			double start = now();
+			Result result = compile(&comp, source.data, &chunk);
+			times[r] = now() - start;
+
+			freeCompiler(&comp);
+			if(result)
+			{
+				fprintf(stderr, "%s: does not compile.\n", workloads[w].name);
+				return 1;
+			}
+			if(r < runs - 1)
+				freeChunk(&chunk);
+		}
+		report(&first, workloads[w].name, "compile", times, runs, bytes, "MB/s");
+
+		// chunks have no jumps, every instruction runs once.
+		double instructions = 0;
+		for(size_t i = 0; i < chunk.size; i += opCodeSize(chunk.data[i]))
+			instructions++;
+
+		VM vm;
+		initVM(&vm);
+		vm.out.file = NULL;
+		vm.inputs = inputs;
+		for(int r = 0; r < runs; r++)
+		{
+			resetVM(&vm);
+			vm.out.size = 0;
+			loadChunk(&vm, &chunk);
+			double start = now();
+			run(&vm);
+			times[r] = now() - start;
+		}
+		report(&first, workloads[w].name, "run", times, runs, instructions, "M instructions/s");
+		fprintf(stderr, "%-9s %.0f bytes, %ld tokens, %.0f instructions\n", workloads[w].name, bytes, tokens, instructions);
+
+		freeVM(&vm);
+		freeChunk(&chunk);
+		freeOutputBuffer(&source);
+	}
+
+	printf("\n  ]\n}\n");
+	free(times);
+	return 0;
+}
@@ -0,0 +1,77 @@
+// measures run() throughput on long arithmetic chunks.
+// build both dispatch modes and compare:
+//   gcc -O2 -o dispatch bench/dispatch.c
+//   gcc -O2 -DNO_THREADED_DISPATCH -o dispatch_switch bench/dispatch.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../src/vm.h"
+
+#define OPERATIONS 1000000
+#define RUNS 20
+
+double now()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// 1 + 2 * 3 - 4 / 5 + 2 * 3 - ... built by hand so the compiler can not simplify it.
+void buildChunk(Chunk* chunk, uint32_t operations)
+{
+	uint8_t ops[] = { OP_ADD, OP_MULTIPLY, OP_SUBTRACT, OP_DIVIDE };
+	for(int i = 1; i <= 5; i++)
+		addToValueArray(&chunk->values, i);
+
+	addToChunk(chunk, OP_CONSTANT, 1);
+	addToChunk(chunk, 0, 1);
+	for(uint32_t i = 0; i < operations; i++)
+	{
+		addToChunk(chunk, OP_CONSTANT, 1);
+		addToChunk(chunk, (uint8_t)(1 + i % 4), 1);
+		if(i % 8 == 3)
+			addToChunk(chunk, OP_NEGATE, 1);
+		addToChunk(chunk, ops[i % 4], 1);
+	}
+	addToChunk(chunk, OP_RETURN, 1);
+}
+
+int main(int argc, char const *argv[])
+{
+	uint32_t operations = argc > 1 ? (uint32_t)atol(argv[1]) : OPERATIONS;
+
+	Chunk chunk;
+	initChunk(&chunk);
+	buildChunk(&chunk, operations);
+	chunk.maxStack = measureStack(&chunk);
+
+	// every operation is a constant, an operator and sometimes a negate.
+	double instructions = 1 + operations * 2 + operations / 8 + 1;
+	double best = 1e30;
+
+	VM vm;
+	initVM(&vm);
+	for(int i = 0; i < RUNS; i++)
+	{
+		vm.stackTop = vm.stack;
+		loadChunk(&vm, &chunk);
+
+		double start = now();
+		run(&vm);
+		double time = now() - start;
+		if(time < best)
+			best = time;
+	}
+	freeVM(&vm);
+	freeChunk(&chunk);
+
+#ifdef THREADED_DISPATCH
+	const char* mode = "threaded";
+#else
+	const char* mode = "switch";
+#endif
+	printf("dispatch: %s | instructions: %.0f | best: %.3f ms | %.1f M ops/sec\n", mode, instructions, best * 1e3, instructions / best / 1e6);
+	return 0;
+}
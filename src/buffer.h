@@ -0,0 +1,114 @@
+#ifndef BUFFER_H
+#define BUFFER_H
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define OUTPUT_BUFFER_SIZE (64 * 1024)
+
+#if defined(__GNUC__)
+// lets the compiler check the arguments of writeFormat() against the format.
+#define FORMAT_PRINTF(formatIndex, firstArgument) __attribute__((format(printf, formatIndex, firstArgument)))
+#else
+#define FORMAT_PRINTF(formatIndex, firstArgument)
+#endif
+
+typedef struct OutputBuffer
+{
+	char* data;
+	size_t size;
+	size_t capacity;
+	FILE* file; // written to when the buffer is full, NULL keeps everything in memory.
+} OutputBuffer;
+
+void initOutputBuffer(OutputBuffer* out, FILE* file, size_t capacity)
+{
+	out->file = file;
+	out->size = 0;
+	out->capacity = capacity;
+
+	if(!(out->data = (char*)malloc(capacity)))
+	{
+		fprintf(stderr, "memory allocation failed!\n");
+		exit(74);
+	}
+}
+
+void flushOutputBuffer(OutputBuffer* out)
+{
+	if(!out->file)
+		return;
+
+	fwrite(out->data, 1, out->size, out->file);
+	fflush(out->file);
+	out->size = 0;
+}
+
+// makes sure at least bytes can be written without flushing.
+void reserveOutputBuffer(OutputBuffer* out, size_t bytes)
+{
+	if(out->capacity - out->size >= bytes)
+		return;
+
+	flushOutputBuffer(out);
+	if(out->capacity - out->size >= bytes)
+		return;
+
+	while(out->capacity - out->size < bytes)
+		out->capacity *= 2;
+
+	if(!(out->data = (char*)realloc(out->data, out->capacity)))
+	{
+		fprintf(stderr, "memory allocation failed!\n");
+		exit(74);
+	}
+}
+
+void writeBytes(OutputBuffer* out, const char* bytes, size_t length)
+{
+	reserveOutputBuffer(out, length);
+	memcpy(out->data + out->size, bytes, length);
+	out->size += length;
+}
+
+void writeChar(OutputBuffer* out, char c)
+{
+	if(out->size == out->capacity)
+		reserveOutputBuffer(out, 1);
+	out->data[out->size++] = c;
+}
+
+void writeString(OutputBuffer* out, const char* string)
+{
+	writeBytes(out, string, strlen(string));
+}
+
+FORMAT_PRINTF(2, 3)
+void writeFormat(OutputBuffer* out, const char* format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	int length = vsnprintf(out->data + out->size, out->capacity - out->size, format, args);
+	va_end(args);
+
+	if(length < 0)
+		return;
+
+	if((size_t)length >= out->capacity - out->size)
+	{
+		reserveOutputBuffer(out, length + 1);
+		va_start(args, format);
+		vsnprintf(out->data + out->size, out->capacity - out->size, format, args);
+		va_end(args);
+	}
+	out->size += length;
+}
+
+void freeOutputBuffer(OutputBuffer* out)
+{
+	flushOutputBuffer(out);
+	free(out->data);
+}
+
+#endif
@@ -0,0 +1,246 @@
+#ifndef BYTECODE_H
+#define BYTECODE_H
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "chunk.h"
+
+// precompiled chunks. the file is laid out so it can be mapped and used in place:
+// header, constants (8 byte aligned), line run offsets, line run lines, code.
+// numbers are stored in the byte order of the machine, a file from another byte order fails the magic check.
+// files come from users and the cache, so readBytecode() checks the layout and walks the code once:
+// every opcode is known, operands are in the code, indices in range, the stack never underflows and
+// the code ends with a return. the line runs must cover the code from offset 0 in increasing order.
+// maxStack is measured again, the one in the header is not used.
+
+#define BYTECODE_MAGIC 0x42534843 // "CHSB"
+#define BYTECODE_VERSION 2
+
+typedef struct BytecodeHeader
+{
+	uint32_t magic;
+	uint16_t version;
+	uint8_t type; // ChunkType
+	uint8_t reserved;
+	uint32_t codeSize;
+	uint32_t valueCount;
+	uint32_t lineCount;
+	uint32_t maxStack;
+} BytecodeHeader;
+
+size_t bytecodeFileSize(BytecodeHeader* header)
+{
+	return sizeof(BytecodeHeader) + header->valueCount * sizeof(Value) + (size_t)header->lineCount * 2 * sizeof(uint32_t) + header->codeSize;
+}
+
+void makeBytecodeHeader(Chunk* chunk, BytecodeHeader* header)
+{
+	memset(header, 0, sizeof(BytecodeHeader));
+	header->magic = BYTECODE_MAGIC;
+	header->version = BYTECODE_VERSION;
+	header->type = (uint8_t)chunk->type;
+	header->codeSize = (uint32_t)chunk->size;
+	header->valueCount = (uint32_t)chunk->values.size;
+	header->lineCount = (uint32_t)chunk->lines.size;
+	header->maxStack = (uint32_t)chunk->maxStack;
+}
+
+bool writeBytecode(Chunk* chunk, FILE* f)
+{
+	BytecodeHeader header;
+	makeBytecodeHeader(chunk, &header);
+
+	return fwrite(&header, sizeof(header), 1, f) == 1 &&
+		fwrite(chunk->values.data, sizeof(Value), header.valueCount, f) == header.valueCount &&
+		fwrite(chunk->lines.offsets, sizeof(uint32_t), header.lineCount, f) == header.lineCount &&
+		fwrite(chunk->lines.lines, sizeof(uint32_t), header.lineCount, f) == header.lineCount &&
+		fwrite(chunk->data, 1, header.codeSize, f) == header.codeSize;
+}
+
+bool writeBytecodeFile(Chunk* chunk, const char* path)
+{
+	FILE* f = fopen(path, "wb");
+	if(f == NULL)
+	{
+		fprintf(stderr, "could not open file: \"%s\".\n", path);
+		return false;
+	}
+
+	bool written = writeBytecode(chunk, f);
+	if(fclose(f) || !written)
+	{
+		fprintf(stderr, "could not write file: \"%s\".\n", path);
+		return false;
+	}
+	return true;
+}
+
+bool isBytecodeFile(const char* path)
+{
+	FILE* f = fopen(path, "rb");
+	if(f == NULL)
+		return false;
+
+	uint32_t magic = 0;
+	bool bytecode = fread(&magic, sizeof(magic), 1, f) == 1 && magic == BYTECODE_MAGIC;
+	fclose(f);
+	return bytecode;
+}
+
+// returns false if running the code could read or write outside the chunk, its constants or the stack.
+// only chunks compiled from source with --columns get inputs, so code with OP_INPUT is rejected too.
+bool validateCode(Chunk* chunk)
+{
+	size_t values = chunk->values.size;
+	uint8_t* code = chunk->data;
+	size_t size = chunk->size;
+	uint8_t last = 0;
+
+	if(chunk->type == CHUNK_REGISTER)
+	{
+		for(size_t i = 0; i < size; i += registerOpCodeSize(last))
+		{
+			last = code[i];
+			if(last > ROP_DIVIDE || i + registerOpCodeSize(last) > size)
+				return false;
+
+			if(last == ROP_LOAD && readShort(chunk, i + 2) >= values)
+				return false;
+
+			size_t first = last == ROP_RETURN ? i + 1 : i + 2;
+			size_t end = last == ROP_LOAD ? first : i + registerOpCodeSize(last);
+			for(size_t source = first; source < end; source += 2)
+			{
+				uint16_t operand = readShort(chunk, source);
+				if((operand & RK_CONSTANT) && (size_t)(operand & ~RK_CONSTANT) >= values)
+					return false;
+			}
+		}
+		return size == 0 || last == ROP_RETURN;
+	}
+
+	long depth = 0;
+	for(size_t i = 0; i < size; i += opCodeSize(last))
+	{
+		last = code[i];
+		if(last >= OP_COUNT || last == OP_INPUT || i + opCodeSize(last) > size)
+			return false;
+
+		switch(last)
+		{
+			case OP_CONSTANT:
+			case OP_ADD_CONSTANT:
+			case OP_SUBTRACT_CONSTANT:
+			case OP_MULTIPLY_CONSTANT:
+			case OP_DIVIDE_CONSTANT:
+				if(code[i + 1] >= values)
+					return false;
+				break;
+			case OP_CONSTANT_CONSTANT:
+				if(code[i + 1] >= values || code[i + 2] >= values)
+					return false;
+				break;
+			case OP_LONG_CONSTANT:
+				if(readShort(chunk, i + 1) >= values)
+					return false;
+				break;
+			default:
+				break;
+		}
+
+		// the values an instruction pops must be there.
+		int pops = 0;
+		if(last == OP_RETURN || last == OP_NEGATE || (last >= OP_ADD_CONSTANT && last <= OP_DIVIDE_CONSTANT))
+			pops = 1;
+		else if(last >= OP_ADD && last <= OP_DIVIDE)
+			pops = 2;
+		if(depth < pops)
+			return false;
+		depth += opCodeStackEffect(last);
+	}
+	return size == 0 || last == OP_RETURN;
+}
+
+// returns false if getLine() could read a run that is not there, or past the code.
+bool validateLines(Chunk* chunk)
+{
+	LineInfo* lines = &chunk->lines;
+	if(chunk->size == 0)
+		return true;
+	if(lines->size == 0 || lines->offsets[0] != 0)
+		return false;
+
+	for(size_t i = 1; i < lines->size; i++)
+		if(lines->offsets[i] <= lines->offsets[i - 1])
+			return false;
+	return lines->offsets[lines->size - 1] < chunk->size;
+}
+
+// points chunk at the parts of a mapped or loaded bytecode image, returns false if it is not valid.
+bool readBytecode(Chunk* chunk, uint8_t* image, size_t size)
+{
+	BytecodeHeader* header = (BytecodeHeader*)image;
+	if(size < sizeof(BytecodeHeader) || header->magic != BYTECODE_MAGIC || header->version != BYTECODE_VERSION ||
+	   header->type > CHUNK_REGISTER || bytecodeFileSize(header) != size)
+		return false;
+
+	uint8_t* p = image + sizeof(BytecodeHeader);
+	chunk->type = (ChunkType)header->type;
+
+	chunk->values.data = (Value*)p;
+	chunk->values.size = chunk->values.capacity = header->valueCount;
+	p += header->valueCount * sizeof(Value);
+
+	chunk->lines.offsets = (uint32_t*)p;
+	p += header->lineCount * sizeof(uint32_t);
+	chunk->lines.lines = (uint32_t*)p;
+	p += header->lineCount * sizeof(uint32_t);
+	chunk->lines.size = chunk->lines.capacity = header->lineCount;
+
+	chunk->data = p;
+	chunk->size = chunk->capacity = header->codeSize;
+	if(!validateLines(chunk) || !validateCode(chunk))
+		return false;
+
+	// the vm stack is sized from this and push() does not check, so it is measured instead of trusted.
+	chunk->maxStack = measureStack(chunk);
+	return true;
+}
+
+// maps a bytecode file and uses its pages as the chunk without copying, freeChunk() unmaps it.
+bool loadBytecodeFile(Chunk* chunk, const char* path)
+{
+	int fd = open(path, O_RDONLY);
+	if(fd < 0)
+	{
+		fprintf(stderr, "could not open file: \"%s\".\n", path);
+		return false;
+	}
+
+	struct stat st;
+	void* image = MAP_FAILED;
+	if(!fstat(fd, &st) && st.st_size > 0)
+		image = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if(image == MAP_FAILED)
+	{
+		fprintf(stderr, "could not read file: \"%s\".\n", path);
+		return false;
+	}
+
+	initChunk(chunk);
+	if(!readBytecode(chunk, (uint8_t*)image, st.st_size))
+	{
+		fprintf(stderr, "not a valid bytecode file: \"%s\".\n", path);
+		munmap(image, st.st_size);
+		initChunk(chunk);
+		return false;
+	}
+
+	chunk->mapping = image;
+	chunk->mappingSize = st.st_size;
+	return true;
+}
+
+#endif
@@ -0,0 +1,257 @@
+#ifndef CACHE_H
+#define CACHE_H
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include "bytecode.h"
+#include "common.h"
+
+// on disk cache of compiled chunks.
+// a chunk is stored as a bytecode file named after a hash of the source, its length, the compiler version
+// and the flags that change the compiled code. hits update the modification time of the file, and when the
+// directory grows past maxSize the least recently used files are removed.
+// hit and miss counts are kept in the file "stats" in the directory.
+
+#define CACHE_DEFAULT_SIZE (64 * 1024 * 1024)
+
+typedef struct Cache
+{
+	char directory[PATH_MAX];
+	size_t maxSize;
+
+	uint64_t hits; // of this process.
+	uint64_t misses;
+} Cache;
+
+typedef struct CacheEntry
+{
+	char name[64];
+	off_t size;
+	time_t used;
+} CacheEntry;
+
+// hashes 8 bytes at a time.
+uint64_t hashBytes(const void* bytes, size_t length, uint64_t seed)
+{
+	const uint8_t* p = (const uint8_t*)bytes;
+	uint64_t h = seed ^ (length * 0x9e3779b97f4a7c15ULL);
+
+	for(; length >= 8; length -= 8, p += 8)
+	{
+		uint64_t word;
+		memcpy(&word, p, 8);
+		word *= 0x87c37b91114253d5ULL;
+		word = (word << 31) | (word >> 33);
+		h = (h ^ word) * 0x4cf5ad432745937fULL;
+		h = (h << 27) | (h >> 37);
+	}
+
+	uint64_t last = 0;
+	memcpy(&last, p, length);
+	h ^= last * 0x87c37b91114253d5ULL;
+
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+// flags are the options that change the compiled chunk. returns false when the path does not fit in PATH_MAX.
+bool cachePath(Cache* cache, const char* source, uint32_t flags, char* path)
+{
+	const char* version = COMPILER_VERSION;
+	size_t length = strlen(source);
+	uint64_t seed = hashBytes(version, strlen(version), ((uint64_t)BYTECODE_VERSION << 32) | flags);
+	return (size_t)snprintf(path, PATH_MAX, "%s/%016llx-%zx.csb", cache->directory, (unsigned long long)hashBytes(source, length, seed), length) < PATH_MAX;
+}
+
+// creates the directory and its parents.
+bool makeDirectories(const char* directory)
+{
+	char path[PATH_MAX];
+	if((size_t)snprintf(path, sizeof(path), "%s", directory) >= sizeof(path))
+		return false;
+
+	for(char* p = path + 1; ; p++)
+	{
+		if(*p != '/' && *p != '\0')
+			continue;
+
+		char c = *p;
+		*p = '\0';
+		if(mkdir(path, 0755) && errno != EEXIST)
+			return false;
+		if(!(*p = c))
+			return true;
+	}
+}
+
+// uses directory, or $CHEESE_CACHE_DIR, $XDG_CACHE_HOME/cheese, ~/.cache/cheese when it is NULL.
+bool initCache(Cache* cache, const char* directory, size_t maxSize)
+{
+	cache->maxSize = maxSize;
+	cache->hits = 0;
+	cache->misses = 0;
+
+	int length;
+	if(directory)
+		length = snprintf(cache->directory, PATH_MAX, "%s", directory);
+	else if(getenv("CHEESE_CACHE_DIR"))
+		length = snprintf(cache->directory, PATH_MAX, "%s", getenv("CHEESE_CACHE_DIR"));
+	else if(getenv("XDG_CACHE_HOME"))
+		length = snprintf(cache->directory, PATH_MAX, "%s/cheese", getenv("XDG_CACHE_HOME"));
+	else if(getenv("HOME"))
+		length = snprintf(cache->directory, PATH_MAX, "%s/.cache/cheese", getenv("HOME"));
+	else
+		length = snprintf(cache->directory, PATH_MAX, ".cheese-cache");
+
+	if((size_t)length >= PATH_MAX)
+	{
+		fprintf(stderr, "cache directory path is too long.\n");
+		return false;
+	}
+	if(!makeDirectories(cache->directory))
+	{
+		fprintf(stderr, "could not create cache directory: \"%s\".\n", cache->directory);
+		return false;
+	}
+	return true;
+}
+
+// adds the counts of this process to the stats file, concurrent processes may lose an update.
+void saveCacheStats(Cache* cache, uint64_t* hits, uint64_t* misses)
+{
+	char path[PATH_MAX];
+	bool fits = (size_t)snprintf(path, sizeof(path), "%s/stats", cache->directory) < sizeof(path);
+
+	unsigned long long savedHits = 0, savedMisses = 0;
+	FILE* f = fits ? fopen(path, "r") : NULL;
+	if(f)
+	{
+		if(fscanf(f, "%llu %llu", &savedHits, &savedMisses) != 2)
+			savedHits = savedMisses = 0;
+		fclose(f);
+	}
+
+	*hits = savedHits + cache->hits;
+	*misses = savedMisses + cache->misses;
+	if(!fits || (!cache->hits && !cache->misses))
+		return;
+
+	if((f = fopen(path, "w")))
+	{
+		fprintf(f, "%llu %llu\n", (unsigned long long)*hits, (unsigned long long)*misses);
+		fclose(f);
+	}
+	cache->hits = cache->misses = 0;
+}
+
+void freeCache(Cache* cache)
+{
+	uint64_t hits, misses;
+	saveCacheStats(cache, &hits, &misses);
+}
+
+// maps the cached chunk of source, returns false on a miss.
+bool loadCachedChunk(Cache* cache, const char* source, uint32_t flags, Chunk* chunk)
+{
+	char path[PATH_MAX];
+	if(!cachePath(cache, source, flags, path))
+		return false;
+
+	if(access(path, R_OK) || !isBytecodeFile(path) || !loadBytecodeFile(chunk, path))
+	{
+		cache->misses++;
+		return false;
+	}
+
+	utimensat(AT_FDCWD, path, NULL, 0);
+	cache->hits++;
+	return true;
+}
+
+int compareCacheEntries(const void* a, const void* b)
+{
+	time_t usedA = ((const CacheEntry*)a)->used;
+	time_t usedB = ((const CacheEntry*)b)->used;
+	return usedA < usedB ? -1 : usedA > usedB ? 1 : 0;
+}
+
+// removes the least recently used chunks until the directory is below maxSize.
+void evictCache(Cache* cache)
+{
+	DIR* dir = opendir(cache->directory);
+	if(!dir)
+		return;
+
+	CacheEntry* entries = NULL;
+	size_t size = 0, capacity = 0;
+	off_t total = 0;
+	char path[PATH_MAX];
+
+	struct dirent* d;
+	while((d = readdir(dir)))
+	{
+		size_t length = strlen(d->d_name);
+		struct stat st;
+		if(length < 4 || length >= sizeof(entries->name) || strcmp(d->d_name + length - 4, ".csb"))
+			continue;
+
+		if((size_t)snprintf(path, sizeof(path), "%s/%s", cache->directory, d->d_name) >= sizeof(path) || stat(path, &st))
+			continue;
+
+		if(size == capacity)
+		{
+			capacity = capacity < 64 ? 64 : capacity * 2;
+			if(!(entries = (CacheEntry*)realloc(entries, capacity * sizeof(CacheEntry))))
+			{
+				fprintf(stderr, "memory allocation failed!\n");
+				exit(74);
+			}
+		}
+		memcpy(entries[size].name, d->d_name, length + 1);
+		entries[size].size = st.st_size;
+		entries[size++].used = st.st_mtime;
+		total += st.st_size;
+	}
+	closedir(dir);
+
+	if((size_t)total > cache->maxSize)
+	{
+		qsort(entries, size, sizeof(CacheEntry), compareCacheEntries);
+		for(size_t i = 0; i < size && (size_t)total > cache->maxSize; i++)
+		{
+			if((size_t)snprintf(path, sizeof(path), "%s/%s", cache->directory, entries[i].name) < sizeof(path) && !unlink(path))
+				total -= entries[i].size;
+		}
+	}
+	free(entries);
+}
+
+// writes a compiled chunk under a temporary name and renames it, so readers never see a partial file.
+void storeCachedChunk(Cache* cache, const char* source, uint32_t flags, Chunk* chunk)
+{
+	char path[PATH_MAX];
+	char temporary[PATH_MAX + 32];
+	if(!cachePath(cache, source, flags, path) ||
+	   (size_t)snprintf(temporary, sizeof(temporary), "%s.%ld.tmp", path, (long)getpid()) >= sizeof(temporary))
+		return;
+
+	FILE* f = fopen(temporary, "wb");
+	if(!f)
+		return;
+
+	bool written = writeBytecode(chunk, f);
+	if(fclose(f) || !written || rename(temporary, path))
+	{
+		unlink(temporary);
+		return;
+	}
+
+	evictCache(cache);
+}
+
+#endif
@@ -3,6 +3,9 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "memory.h"
 #include "value.h"
 #include "opCode.h"
 
@@ -11,22 +14,46 @@ typedef struct ValueArray
 	Value* data;
 	size_t size;
 	size_t capacity;
+
+	// open addressing table used by internValue(), holds index + 1 of a value, 0 is an empty slot.
+	uint32_t* table;
+	size_t tableCapacity;
+
+	Allocator* allocator;
 } ValueArray;
 
 typedef struct LineInfo
 {
-	uint32_t* data; // [line, amount, line, amount, ...]
+	// a run for every change of line: the offset of its first byte and its line, sorted by offset.
+	uint32_t* offsets;
+	uint32_t* lines;
 	size_t size;
 	size_t capacity;
+	size_t cursor; // run of the last lookup, so walking through the chunk does not search.
+
+	Allocator* allocator;
 } LineInfo;
 
+typedef enum ChunkType
+{
+	CHUNK_STACK, // opCode, executed by run().
+	CHUNK_REGISTER, // registerOpCode, executed by runRegisters().
+} ChunkType;
+
 typedef struct Chunk
 {
+	ChunkType type;
 	uint8_t* data;
 	size_t size;
 	size_t capacity;
 	ValueArray values;
 	LineInfo lines;
+	Allocator* allocator; // of the code, values and lines.
+	size_t maxStack; // values the vm needs on the stack (or registers), see measureStack().
+
+	// set when the chunk points into a mapped bytecode file, see bytecode.h. mapped chunks are read only.
+	void* mapping;
+	size_t mappingSize;
 } Chunk;
 
 void initValueArray(ValueArray* valueArray)
@@ -34,119 +61,267 @@ void initValueArray(ValueArray* valueArray)
 	valueArray->data = NULL;
 	valueArray->size = 0;
 	valueArray->capacity = 0;
+	valueArray->table = NULL;
+	valueArray->tableCapacity = 0;
+	valueArray->allocator = &heapAllocator;
 }
 
 void initLineInfo(LineInfo* lineInfo)
 {
-	lineInfo->data = NULL;
+	lineInfo->offsets = NULL;
+	lineInfo->lines = NULL;
 	lineInfo->size = 0;
 	lineInfo->capacity = 0;
+	lineInfo->cursor = 0;
+	lineInfo->allocator = &heapAllocator;
 }
 
-void initChunk(Chunk* chunk)
+// everything the chunk grows is allocated from allocator.
+void initChunkWithAllocator(Chunk* chunk, Allocator* allocator)
 {
+	chunk->type = CHUNK_STACK;
 	chunk->data = NULL;
 	chunk->size = 0;
 	chunk->capacity = 0;
 	initValueArray(&chunk->values);
 	initLineInfo(&chunk->lines);
+	chunk->allocator = chunk->values.allocator = chunk->lines.allocator = allocator;
+	chunk->mapping = NULL;
+	chunk->mappingSize = 0;
+	chunk->maxStack = 0;
+}
+
+void initChunk(Chunk* chunk)
+{
+	initChunkWithAllocator(chunk, &heapAllocator);
 }
 
-void addToLineInfo(LineInfo* lineInfo, uint32_t line)
+// grows the buffers of an empty chunk up front, so compiling source of a known size does not reallocate.
+void reserveChunk(Chunk* chunk, size_t code, size_t values, size_t lines)
 {
-	if(lineInfo->data && (lineInfo->data[lineInfo->size - 2] == line))
+	if(code > chunk->capacity)
 	{
-		lineInfo->data[lineInfo->size - 1]++;
-		return;
+		chunk->data = (uint8_t*)reallocate(chunk->allocator, chunk->data, chunk->capacity, code);
+		chunk->capacity = code;
+	}
+	if(values > chunk->values.capacity)
+	{
+		chunk->values.data = (Value*)reallocate(chunk->allocator, chunk->values.data, chunk->values.capacity * sizeof(Value), values * sizeof(Value));
+		chunk->values.capacity = values;
+	}
+	if(lines > chunk->lines.capacity)
+	{
+		chunk->lines.offsets = (uint32_t*)reallocate(chunk->allocator, chunk->lines.offsets, chunk->lines.capacity * sizeof(uint32_t), lines * sizeof(uint32_t));
+		chunk->lines.lines = (uint32_t*)reallocate(chunk->allocator, chunk->lines.lines, chunk->lines.capacity * sizeof(uint32_t), lines * sizeof(uint32_t));
+		chunk->lines.capacity = lines;
 	}
+}
+
+void addToLineInfo(LineInfo* lineInfo, uint32_t offset, uint32_t line)
+{
+	if(lineInfo->size && lineInfo->lines[lineInfo->size - 1] == line)
+		return;
 
 	if(lineInfo->capacity == lineInfo->size)
 	{
-		if(lineInfo->capacity <= 8)
+		size_t oldCapacity = lineInfo->capacity;
+		if(lineInfo->capacity < 8)
 			lineInfo->capacity = 8;
 		else
 			lineInfo->capacity = lineInfo->capacity * 2;
 
-		if(!(lineInfo->data = (uint32_t*)realloc(lineInfo->data, lineInfo->capacity * sizeof(uint32_t))))
-		{
-			fprintf(stderr, "memory allocation failed!\n");
-			exit(1);
-		}
+		lineInfo->offsets = (uint32_t*)reallocate(lineInfo->allocator, lineInfo->offsets, oldCapacity * sizeof(uint32_t), lineInfo->capacity * sizeof(uint32_t));
+		lineInfo->lines = (uint32_t*)reallocate(lineInfo->allocator, lineInfo->lines, oldCapacity * sizeof(uint32_t), lineInfo->capacity * sizeof(uint32_t));
 	}
-	lineInfo->data[lineInfo->size++] = line;
-	lineInfo->data[lineInfo->size++] = 1;
+	lineInfo->offsets[lineInfo->size] = offset;
+	lineInfo->lines[lineInfo->size++] = line;
 }
 
 void addToChunk(Chunk* chunk, uint8_t byte, uint32_t line)
 {
 	if(chunk->capacity == chunk->size)
 	{
-		if(chunk->capacity <= 8)
+		size_t oldCapacity = chunk->capacity;
+		if(chunk->capacity < 8)
 			chunk->capacity = 8;
 		else
 			chunk->capacity = chunk->capacity * 2;
 
-		if(!(chunk->data = (uint8_t*)realloc(chunk->data, chunk->capacity)))
-		{
-			fprintf(stderr, "memory allocation failed!\n");
-			exit(74);
-		}
-
+		chunk->data = (uint8_t*)reallocate(chunk->allocator, chunk->data, oldCapacity, chunk->capacity);
 	}
+	addToLineInfo(&chunk->lines, (uint32_t)chunk->size, line);
 	chunk->data[chunk->size++] = byte;
+}
 
-	addToLineInfo(&chunk->lines, line);
+// removes the code from size to the end, together with its line info.
+void truncateChunk(Chunk* chunk, size_t size)
+{
+	LineInfo* lines = &chunk->lines;
+	chunk->size = size;
+
+	while(lines->size && lines->offsets[lines->size - 1] >= size)
+		lines->size--;
+	lines->cursor = 0;
 }
 
-void freeValueArray(ValueArray* ValueArray)
+void freeValueArray(ValueArray* valueArray)
 {
-	free(ValueArray->data);
+	reallocate(valueArray->allocator, valueArray->data, valueArray->capacity * sizeof(Value), 0);
+	reallocate(valueArray->allocator, valueArray->table, valueArray->tableCapacity * sizeof(uint32_t), 0);
 }
 
 void freeLineInfo(LineInfo* lineInfo)
 {
-	free(lineInfo->data);
+	reallocate(lineInfo->allocator, lineInfo->offsets, lineInfo->capacity * sizeof(uint32_t), 0);
+	reallocate(lineInfo->allocator, lineInfo->lines, lineInfo->capacity * sizeof(uint32_t), 0);
 }
 
 void freeChunk(Chunk* chunk)
 {
-	free(chunk->data);
+	if(chunk->mapping)
+	{
+		munmap(chunk->mapping, chunk->mappingSize);
+		initChunk(chunk);
+		return;
+	}
+
+	reallocate(chunk->allocator, chunk->data, chunk->capacity, 0);
 	freeValueArray(&chunk->values);
 	freeLineInfo(&chunk->lines);
 }
 
 uint32_t addToValueArray(ValueArray* valueArray, Value v)
 {
-
 	if(valueArray->capacity == valueArray->size)
 	{
-		if(valueArray->capacity <= 8)
+		size_t oldCapacity = valueArray->capacity;
+		if(valueArray->capacity < 8)
 			valueArray->capacity = 8;
 		else
 			valueArray->capacity = valueArray->capacity * 2;
 
-		if(!(valueArray->data = (Value*)realloc(valueArray->data, valueArray->capacity * sizeof(Value))))
-		{
-			fprintf(stderr, "memory allocation failed!\n");
-			exit(74);
-		}
+		valueArray->data = (Value*)reallocate(valueArray->allocator, valueArray->data, oldCapacity * sizeof(Value), valueArray->capacity * sizeof(Value));
 	}
 
 	valueArray->data[valueArray->size++] = v;
 	return valueArray->size - 1;
 }
 
-uint32_t getLine(LineInfo* lineInfo, uint32_t index)
+// values are compared bit for bit, so 0 and -0 or nans with different payloads are different constants.
+uint64_t valueBits(Value v)
+{
+	uint64_t bits;
+	memcpy(&bits, &v, sizeof(bits));
+	return bits;
+}
+
+size_t hashValue(Value v)
+{
+	uint64_t h = valueBits(v);
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return (size_t)h;
+}
+
+// returns the slot of v in the table, or the empty slot where it belongs.
+uint32_t* findValueSlot(ValueArray* valueArray, Value v)
 {
-	int32_t i = -2;
-	int32_t distance = index;
-	while (distance >= 0)
+	uint64_t bits = valueBits(v);
+	size_t mask = valueArray->tableCapacity - 1;
+	for(size_t i = hashValue(v) & mask; ; i = (i + 1) & mask)
 	{
-		i += 2;
-		distance -= lineInfo->data[i + 1];
+		uint32_t* slot = &valueArray->table[i];
+		if(!*slot || valueBits(valueArray->data[*slot - 1]) == bits)
+			return slot;
+	}
+}
+
+void growValueTable(ValueArray* valueArray)
+{
+	reallocate(valueArray->allocator, valueArray->table, valueArray->tableCapacity * sizeof(uint32_t), 0);
+	valueArray->tableCapacity = valueArray->tableCapacity < 16 ? 16 : valueArray->tableCapacity * 2;
+	valueArray->table = (uint32_t*)reallocate(valueArray->allocator, NULL, 0, valueArray->tableCapacity * sizeof(uint32_t));
+	memset(valueArray->table, 0, valueArray->tableCapacity * sizeof(uint32_t));
+
+	for(size_t i = 0; i < valueArray->size; i++)
+	{
+		uint32_t* slot = findValueSlot(valueArray, valueArray->data[i]);
+		if(!*slot)
+			*slot = (uint32_t)i + 1;
+	}
+}
+
+// returns the index of a value bitwise equal to v, adding v if there is none.
+uint32_t internValue(ValueArray* valueArray, Value v)
+{
+	if((valueArray->size + 1) * 2 > valueArray->tableCapacity)
+		growValueTable(valueArray);
+
+	uint32_t* slot = findValueSlot(valueArray, v);
+	if(*slot)
+		return *slot - 1;
+
+	uint32_t index = addToValueArray(valueArray, v);
+	*slot = index + 1;
+	return index;
+}
+
+// removes the last value. it was added last, so no other value in the table probed past its slot.
+void removeLastValue(ValueArray* valueArray)
+{
+	uint32_t index = (uint32_t)--valueArray->size;
+	if(!valueArray->tableCapacity)
+		return;
+
+	uint32_t* slot = findValueSlot(valueArray, valueArray->data[index]);
+	if(*slot == index + 1)
+		*slot = 0;
+}
+
+// the run that holds the byte at index.
+size_t getLineRun(LineInfo* lineInfo, uint32_t index)
+{
+	size_t run = lineInfo->cursor;
+	if(run >= lineInfo->size || lineInfo->offsets[run] > index)
+		run = 0;
+
+	// the next lookup is usually in the same run or the one after it.
+	if(run + 1 < lineInfo->size && lineInfo->offsets[run + 1] <= index)
+	{
+		run++;
+		if(run + 1 < lineInfo->size && lineInfo->offsets[run + 1] <= index)
+		{
+			// binary search for the last run starting at or before index.
+			size_t low = run + 1;
+			size_t high = lineInfo->size;
+			while(low < high)
+			{
+				size_t middle = low + (high - low) / 2;
+				if(lineInfo->offsets[middle] <= index)
+					low = middle + 1;
+				else
+					high = middle;
+			}
+			run = low - 1;
+		}
 	}
 
-	return lineInfo->data[i];
+	lineInfo->cursor = run;
+	return run;
+}
+
+uint32_t getLine(LineInfo* lineInfo, uint32_t index)
+{
+	return lineInfo->lines[getLineRun(lineInfo, index)];
+}
+
+// two byte operands are little endian.
+uint16_t readShort(Chunk* chunk, size_t offset)
+{
+	return (uint16_t)(chunk->data[offset] | chunk->data[offset + 1] << 8);
 }
 
 void addConstantInstrution(Chunk* chunk, uint32_t constant, uint32_t line)
@@ -160,8 +335,44 @@ void addConstantInstrution(Chunk* chunk, uint32_t constant, uint32_t line)
 	{
 		addToChunk(chunk, OP_LONG_CONSTANT, line);
 		addToChunk(chunk, (uint8_t)constant, line);
-		addToChunk(chunk, (uint8_t)constant >> 8, line);
+		addToChunk(chunk, (uint8_t)(constant >> 8), line);
+	}
+}
+
+// the deepest the stack gets while running the chunk, for register chunks the highest register + 1.
+// chunks have no jumps, so one walk over the code is enough.
+size_t measureStack(Chunk* chunk)
+{
+	size_t maxStack = 0;
+	if(chunk->type == CHUNK_REGISTER)
+	{
+		for(size_t i = 0; i < chunk->size; i += registerOpCodeSize(chunk->data[i]))
+		{
+			uint8_t op = chunk->data[i];
+			if(op != ROP_RETURN && chunk->data[i + 1] >= maxStack)
+				maxStack = chunk->data[i + 1] + 1;
+
+			// sources are written before they are read, counted anyway so no read can miss the registers.
+			size_t first = op == ROP_RETURN ? i + 1 : i + 2;
+			size_t end = op == ROP_LOAD ? first : i + registerOpCodeSize(op);
+			for(size_t source = first; source + 2 <= end; source += 2)
+			{
+				uint16_t operand = readShort(chunk, source);
+				if(!(operand & RK_CONSTANT) && operand >= maxStack)
+					maxStack = operand + 1;
+			}
+		}
+		return maxStack;
+	}
+
+	long depth = 0;
+	for(size_t i = 0; i < chunk->size; i += opCodeSize(chunk->data[i]))
+	{
+		depth += opCodeStackEffect(chunk->data[i]);
+		if(depth > (long)maxStack)
+			maxStack = depth;
 	}
+	return maxStack;
 }
 
 #endif
\ No newline at end of file
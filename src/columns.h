@@ -0,0 +1,242 @@
+#ifndef COLUMNS_H
+#define COLUMNS_H
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "chunk.h"
+#include "number.h"
+#include "common.h"
+
+// evaluates one stack chunk over whole columns of inputs. every instruction is executed for a
+// block of rows before the next one, so dispatch is paid once per block, and the loops over a
+// block work on vectors of values.
+
+#define COLUMN_BLOCK 256
+
+#if defined(__GNUC__)
+// gcc and clang turn this into sse2 (or avx) instructions, elsewhere a vector is just one value.
+typedef Value ValueVector __attribute__((vector_size(32)));
+#define VECTOR_VALUES 4
+#else
+typedef Value ValueVector;
+#define VECTOR_VALUES 1
+#endif
+
+typedef struct Columns
+{
+	char** names;
+	Value** data; // data[column][row].
+	size_t count;
+	size_t rows;
+	size_t capacity; // rows every column has room for.
+} Columns;
+
+void initColumns(Columns* columns)
+{
+	columns->names = NULL;
+	columns->data = NULL;
+	columns->count = 0;
+	columns->rows = 0;
+	columns->capacity = 0;
+}
+
+void freeColumns(Columns* columns)
+{
+	for(size_t i = 0; i < columns->count; i++)
+	{
+		free(columns->names[i]);
+		reallocate(&heapAllocator, columns->data[i], columns->capacity * sizeof(Value), 0);
+	}
+	free(columns->names);
+	free(columns->data);
+	initColumns(columns);
+}
+
+void addColumn(Columns* columns, const char* name, size_t length)
+{
+	columns->names = (char**)reallocate(&heapAllocator, columns->names, columns->count * sizeof(char*), (columns->count + 1) * sizeof(char*));
+	columns->data = (Value**)reallocate(&heapAllocator, columns->data, columns->count * sizeof(Value*), (columns->count + 1) * sizeof(Value*));
+
+	char* copy = (char*)reallocate(&heapAllocator, NULL, 0, length + 1);
+	memcpy(copy, name, length);
+	copy[length] = '\0';
+	columns->names[columns->count] = copy;
+	columns->data[columns->count++] = columns->capacity ? (Value*)reallocate(&heapAllocator, NULL, 0, columns->capacity * sizeof(Value)) : NULL;
+}
+
+void addRow(Columns* columns)
+{
+	if(columns->capacity == columns->rows)
+	{
+		size_t oldCapacity = columns->capacity;
+		if(columns->capacity < 8)
+			columns->capacity = 8;
+		else
+			columns->capacity = columns->capacity * 2;
+
+		for(size_t i = 0; i < columns->count; i++)
+			columns->data[i] = (Value*)reallocate(&heapAllocator, columns->data[i], oldCapacity * sizeof(Value), columns->capacity * sizeof(Value));
+	}
+	columns->rows++;
+}
+
+bool isFieldSpace(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+// reads comma separated text: a header line with the column names, then one line of numbers per row.
+bool readColumns(Columns* columns, const char* text)
+{
+	const char* p = text;
+	while(true)
+	{
+		while(isFieldSpace(*p))
+			p++;
+		const char* name = p;
+		while(*p && *p != ',' && *p != '\n')
+			p++;
+		const char* end = p;
+		while(end > name && isFieldSpace(end[-1]))
+			end--;
+		addColumn(columns, name, end - name);
+
+		if(*p != ',')
+			break;
+		p++;
+	}
+
+	for(int line = 2; *p; line++)
+	{
+		p++;
+		const char* start = p;
+		while(isFieldSpace(*start))
+			start++;
+		if(*start == '\n' || *start == '\0')
+		{
+			p = start;
+			continue;
+		}
+
+		addRow(columns);
+		for(size_t i = 0; i < columns->count; i++)
+		{
+			while(isFieldSpace(*p))
+				p++;
+			bool negative = *p == '-';
+			if(*p == '-' || *p == '+')
+				p++;
+
+			size_t length = numberLength(p, strcspn(p, ",\n"));
+			Value v = parseNumber(p, length);
+			p += length;
+			while(isFieldSpace(*p))
+				p++;
+
+			char expected = i + 1 < columns->count ? ',' : '\n';
+			if(!length || (*p != expected && !(expected == '\n' && *p == '\0')))
+			{
+				fprintf(stderr, "line %d: expected %zu numbers.\n", line, columns->count);
+				return false;
+			}
+			columns->data[i][columns->rows - 1] = negative ? -v : v;
+			if(expected == ',')
+				p++;
+		}
+	}
+	return true;
+}
+
+#define COLUMN_BINARY(op) { \
+		top--; \
+		for(size_t i = 0; i < vectors; i++) \
+			stack[top - 1][i] = stack[top - 1][i] op stack[top][i]; \
+	}
+
+#define COLUMN_CONSTANT(op) { \
+		Value b = chunk->values.data[*ip++]; \
+		for(size_t i = 0; i < vectors; i++) \
+			stack[top - 1][i] = stack[top - 1][i] op b; \
+	}
+
+void fillColumn(ValueVector* column, size_t vectors, Value v)
+{
+	for(size_t i = 0; i < vectors; i++)
+		column[i] = (ValueVector){ 0 } + v;
+}
+
+// runs a stack chunk for every row, input i of the chunk reads inputs[i], results gets a value per row.
+Result evaluateColumns(Chunk* chunk, Value** inputs, size_t rows, Value* results)
+{
+	size_t slots = chunk->maxStack ? chunk->maxStack : 1;
+	ValueVector* memory = (ValueVector*)aligned_alloc(sizeof(ValueVector), slots * COLUMN_BLOCK * sizeof(Value));
+	ValueVector** stack = (ValueVector**)malloc(slots * sizeof(ValueVector*));
+	if(!memory || !stack)
+	{
+		fprintf(stderr, "memory allocation failed!\n");
+		exit(74);
+	}
+
+	// the lanes after the last row of a block are computed too, they must not hold garbage.
+	memset(memory, 0, slots * COLUMN_BLOCK * sizeof(Value));
+	for(size_t i = 0; i < slots; i++)
+		stack[i] = memory + i * (COLUMN_BLOCK / VECTOR_VALUES);
+
+	for(size_t start = 0; start < rows; start += COLUMN_BLOCK)
+	{
+		size_t count = rows - start < COLUMN_BLOCK ? rows - start : COLUMN_BLOCK;
+		size_t vectors = (count + VECTOR_VALUES - 1) / VECTOR_VALUES;
+		uint8_t* ip = chunk->data;
+		size_t top = 0;
+
+		while(ip < chunk->data + chunk->size)
+		{
+			switch(*ip++)
+			{
+			case OP_RETURN:
+				memcpy(results + start, stack[--top], count * sizeof(Value));
+				ip = chunk->data + chunk->size;
+				break;
+			case OP_CONSTANT:
+				fillColumn(stack[top++], vectors, chunk->values.data[*ip++]);
+				break;
+			case OP_LONG_CONSTANT:
+				ip += 2;
+				fillColumn(stack[top++], vectors, chunk->values.data[ip[-2] | ip[-1] << 8]);
+				break;
+			case OP_CONSTANT_CONSTANT:
+				fillColumn(stack[top++], vectors, chunk->values.data[*ip++]);
+				fillColumn(stack[top++], vectors, chunk->values.data[*ip++]);
+				break;
+			case OP_INPUT:
+				memcpy(stack[top++], inputs[*ip++] + start, count * sizeof(Value));
+				break;
+			case OP_NEGATE:
+				for(size_t i = 0; i < vectors; i++)
+					stack[top - 1][i] = -stack[top - 1][i];
+				break;
+			case OP_ADD:               COLUMN_BINARY(+)   break;
+			case OP_SUBTRACT:          COLUMN_BINARY(-)   break;
+			case OP_MULTIPLY:          COLUMN_BINARY(*)   break;
+			case OP_DIVIDE:            COLUMN_BINARY(/)   break;
+			case OP_ADD_CONSTANT:      COLUMN_CONSTANT(+) break;
+			case OP_SUBTRACT_CONSTANT: COLUMN_CONSTANT(-) break;
+			case OP_MULTIPLY_CONSTANT: COLUMN_CONSTANT(*) break;
+			case OP_DIVIDE_CONSTANT:   COLUMN_CONSTANT(/) break;
+			default:
+				free(memory);
+				free(stack);
+				return RESULT_RUNTIME_ERROR;
+			}
+		}
+	}
+
+	free(memory);
+	free(stack);
+	return RESULT_OK;
+}
+
+#undef COLUMN_BINARY
+#undef COLUMN_CONSTANT
+
+#endif
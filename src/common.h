@@ -1,11 +1,15 @@
 #ifndef COMMON_H
 #define COMMON_H
 
+// part of the key of cached chunks, change it when the compiler emits different code.
+#define COMPILER_VERSION "0.1"
+
 typedef enum Result
 {
 	RESULT_OK,
 	RESULT_COMPILE_ERROR = 65,
 	RESULT_RUNTIME_ERROR = 70,
+	RESULT_IO_ERROR = 74,
 } Result;
 
 #endif
\ No newline at end of file
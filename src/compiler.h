@@ -2,8 +2,11 @@
 #define COMPILER_H
 #include <stdlib.h>
 #include "scanner.h"
+#include "number.h"
 // todo: print line of error
 
+#define FOLD_MAX 256
+
 typedef struct Compiler
 {
     Token current;
@@ -13,16 +16,49 @@ typedef struct Compiler
 
     bool error;
     bool panic;
+
+    // register chunks: operands of the expressions that are not used yet.
+    uint16_t operands[REGISTER_MAX];
+    int operandCount;
+    int registerCount;
+    bool tooDeep; // ran out of operands or registers, compile() starts over with a stack chunk.
+
+    // stack chunks: the constant instructions at the end of the chunk, used to fold constant expressions.
+    size_t constantStarts[FOLD_MAX];
+    uint32_t constantIndices[FOLD_MAX];
+    int constantCount;
+
+    // how many instructions use each constant, a constant is removed when folding leaves it unused.
+    uint32_t* references;
+    size_t referencesCapacity;
+
+    // names identifiers can refer to, compiled to OP_INPUT with their index. NULL when there are none.
+    const char* const* inputs;
+    int inputCount;
+
+    Allocator* allocator; // the one of the chunk.
+    OutputBuffer* errors; // error messages are written here, NULL writes them to stderr.
 } Compiler;
 
 void initCompiler(Compiler* comp)
 {
     comp->error = false;
     comp->panic = false;
+    comp->operandCount = 0;
+    comp->registerCount = 0;
+    comp->tooDeep = false;
+    comp->constantCount = 0;
+    comp->references = NULL;
+    comp->referencesCapacity = 0;
+    comp->inputs = NULL;
+    comp->inputCount = 0;
+    comp->allocator = &heapAllocator;
+    comp->errors = NULL;
 }
 
 void freeCompiler(Compiler* comp)
 {
+    reallocate(comp->allocator, comp->references, comp->referencesCapacity * sizeof(uint32_t), 0);
 }
 
 void error(Compiler* comp, Token token, const char* message)
@@ -30,12 +66,23 @@ void error(Compiler* comp, Token token, const char* message)
     if(comp->panic)
         return;
 
+    OutputBuffer out;
+    OutputBuffer* errors = comp->errors;
+    if(!errors)
+    {
+        initOutputBuffer(&out, stderr, 256);
+        errors = &out;
+    }
+
     if(token.type == TOKEN_EOF)
-        printf("\x1B[31m[at %d:%d] Error at end: %s.\x1B[0m\n", token.line, token.collumn, message);
+        writeFormat(errors, "\x1B[31m[at %d:%d] Error at end: %s.\x1B[0m\n", token.line, token.collumn, message);
     else if (token.type == TOKEN_ERROR)
-        printf("\x1B[31m[at %d:%d] Error: %.*s.\x1B[0m\n", token.line, token.collumn, token.length, message);
+        writeFormat(errors, "\x1B[31m[at %d:%d] Error: %.*s.\x1B[0m\n", token.line, token.collumn, token.length, message);
     else
-        printf("\x1B[31m[at %d:%d] Error at '%.*s': %s.\x1B[0m\n", token.line, token.collumn, token.length, token.start, message);
+        writeFormat(errors, "\x1B[31m[at %d:%d] Error at '%.*s': %s.\x1B[0m\n", token.line, token.collumn, token.length, token.start, message);
+
+    if(errors == &out)
+        freeOutputBuffer(&out);
     comp->error = true;
 }
 
@@ -46,6 +93,7 @@ void errorAtCurrent(Compiler* comp, const char* message)
 
 void emitByte(Compiler* comp, uint8_t byte)
 {
+    comp->constantCount = 0;
     addToChunk(comp->chunk, byte, comp->previous.line);
 }
 
@@ -57,18 +105,215 @@ void emitBytes(Compiler* comp, uint8_t byte1, uint8_t byte2)
 
 uint32_t makeConstant(Compiler* comp, Value v)
 {
-    int constant = addToValueArray(&comp->chunk->values, v);
+    uint32_t constant = internValue(&comp->chunk->values, v);
     if(constant >= 0xffff)
     {
         errorAtCurrent(comp, "Too many constant in one chunk.");
         return 0;
     }
+
+    if(constant >= comp->referencesCapacity)
+    {
+        size_t capacity = comp->referencesCapacity < 8 ? 8 : comp->referencesCapacity * 2;
+        comp->references = (uint32_t*)reallocate(comp->allocator, comp->references, comp->referencesCapacity * sizeof(uint32_t), capacity * sizeof(uint32_t));
+        memset(comp->references + comp->referencesCapacity, 0, (capacity - comp->referencesCapacity) * sizeof(uint32_t));
+        comp->referencesCapacity = capacity;
+    }
+    comp->references[constant]++;
     return constant;
 }
 
+void emitShort(Compiler* comp, uint16_t value)
+{
+    emitBytes(comp, (uint8_t)value, (uint8_t)(value >> 8));
+}
+
+// the rest of the register chunk is thrown away, so its errors are not reported.
+void outOfRegisters(Compiler* comp)
+{
+    comp->tooDeep = true;
+    comp->panic = true;
+}
+
+void pushOperand(Compiler* comp, uint16_t operand)
+{
+    if(comp->operandCount == REGISTER_MAX)
+    {
+        outOfRegisters(comp);
+        return;
+    }
+    comp->operands[comp->operandCount++] = operand;
+}
+
+// operands are used in the opposite order they are made, so registers are freed like a stack.
+uint16_t popOperand(Compiler* comp)
+{
+    if(comp->operandCount == 0)
+        return RK_CONSTANT;
+
+    uint16_t operand = comp->operands[--comp->operandCount];
+    if(!(operand & RK_CONSTANT))
+        comp->registerCount--;
+    return operand;
+}
+
+uint8_t allocateRegister(Compiler* comp)
+{
+    if(comp->registerCount == REGISTER_MAX)
+    {
+        outOfRegisters(comp);
+        return 0;
+    }
+    return (uint8_t)comp->registerCount++;
+}
+
 void emitConstant(Compiler* comp, Value value)
 {
-    addConstantInstrution(comp->chunk, makeConstant(comp, value), comp->previous.line);
+    uint32_t constant = makeConstant(comp, value);
+    if(comp->chunk->type == CHUNK_STACK)
+    {
+        if(comp->constantCount == FOLD_MAX)
+        {
+            comp->constantCount--;
+            memmove(comp->constantStarts, comp->constantStarts + 1, comp->constantCount * sizeof(size_t));
+            memmove(comp->constantIndices, comp->constantIndices + 1, comp->constantCount * sizeof(uint32_t));
+        }
+        comp->constantStarts[comp->constantCount] = comp->chunk->size;
+        comp->constantIndices[comp->constantCount++] = constant;
+        addConstantInstrution(comp->chunk, constant, comp->previous.line);
+        return;
+    }
+
+    if(constant < RK_CONSTANT)
+    {
+        pushOperand(comp, (uint16_t)constant | RK_CONSTANT);
+        return;
+    }
+
+    uint8_t destination = allocateRegister(comp);
+    emitBytes(comp, ROP_LOAD, destination);
+    emitShort(comp, (uint16_t)constant);
+    pushOperand(comp, destination);
+}
+
+// called when an instruction using constant is removed.
+// unused constants at the end of the pool are removed, others stay until the end of the chunk.
+void dropConstant(Compiler* comp, uint32_t constant)
+{
+    comp->references[constant]--;
+
+    ValueArray* values = &comp->chunk->values;
+    while(values->size && !comp->references[values->size - 1])
+        removeLastValue(values);
+}
+
+// same arithmetic as the vm, so folding does not change any result.
+Value applyOperator(uint8_t op, Value a, Value b)
+{
+    switch(op)
+    {
+        case OP_NEGATE  : return -a;
+        case OP_ADD     : return a + b;
+        case OP_SUBTRACT: return a - b;
+        case OP_MULTIPLY: return a * b;
+        case OP_DIVIDE  : return a / b;
+        default: return 0;
+    }
+}
+
+// replaces an operator on constant operands by a constant, returns false if an operand is not constant.
+bool foldOperator(Compiler* comp, uint8_t op)
+{
+    int operands = op == OP_NEGATE ? 1 : 2;
+    Value* pool = comp->chunk->values.data;
+    Value values[2] = { 0, 0 };
+
+    if(comp->chunk->type == CHUNK_STACK)
+    {
+        if(comp->constantCount < operands)
+            return false;
+
+        comp->constantCount -= operands;
+        uint32_t* indices = comp->constantIndices + comp->constantCount;
+        for(int i = 0; i < operands; i++)
+            values[i] = pool[indices[i]];
+
+        truncateChunk(comp->chunk, comp->constantStarts[comp->constantCount]);
+        for(int i = operands - 1; i >= 0; i--)
+            dropConstant(comp, indices[i]);
+    }
+    else
+    {
+        if(comp->operandCount < operands)
+            return false;
+
+        uint16_t* sources = comp->operands + comp->operandCount - operands;
+        for(int i = 0; i < operands; i++)
+        {
+            if(!(sources[i] & RK_CONSTANT))
+                return false;
+            values[i] = pool[sources[i] & ~RK_CONSTANT];
+        }
+
+        for(int i = 0; i < operands; i++)
+            dropConstant(comp, popOperand(comp) & ~RK_CONSTANT);
+    }
+
+    emitConstant(comp, applyOperator(op, values[0], values[1]));
+    return true;
+}
+
+// emits a stack operator, or its three-address form in register chunks.
+void emitOperator(Compiler* comp, uint8_t op)
+{
+    if(foldOperator(comp, op))
+        return;
+
+    if(comp->chunk->type == CHUNK_STACK)
+    {
+        emitByte(comp, op);
+        return;
+    }
+
+    if(op == OP_NEGATE)
+    {
+        uint16_t source = popOperand(comp);
+        uint8_t destination = allocateRegister(comp);
+        emitBytes(comp, ROP_NEGATE, destination);
+        emitShort(comp, source);
+        pushOperand(comp, destination);
+        return;
+    }
+
+    uint8_t registerOp;
+    switch(op)
+    {
+        case OP_ADD     : registerOp = ROP_ADD     ; break;
+        case OP_SUBTRACT: registerOp = ROP_SUBTRACT; break;
+        case OP_MULTIPLY: registerOp = ROP_MULTIPLY; break;
+        case OP_DIVIDE  : registerOp = ROP_DIVIDE  ; break;
+        default: return;
+    }
+
+    uint16_t right = popOperand(comp);
+    uint16_t left = popOperand(comp);
+    uint8_t destination = allocateRegister(comp);
+    emitBytes(comp, registerOp, destination);
+    emitShort(comp, left);
+    emitShort(comp, right);
+    pushOperand(comp, destination);
+}
+
+void emitReturn(Compiler* comp)
+{
+    if(comp->chunk->type == CHUNK_STACK)
+    {
+        emitByte(comp, OP_RETURN);
+        return;
+    }
+
+    emitByte(comp, ROP_RETURN);
+    emitShort(comp, popOperand(comp));
 }
 
 Token nextToken(Compiler* comp)
@@ -107,128 +352,154 @@ typedef enum Precedence
     PREC_PRIMARY,
 } Precedence;
 
-typedef void(*parseFn)(Compiler*);
-
-typedef struct ParseRule
-{
-    parseFn prefix;
-    parseFn infix;
-    Precedence precedence;
-} ParseRule;
-
-void group (Compiler*);
-void binary(Compiler*);
-void unary (Compiler*);
-void number(Compiler*);
-
-ParseRule rules[] = {
-    [TOKEN_LEFT_PAREN]         = {group , NULL  , PREC_NONE  },
-    [TOKEN_RIGHT_PAREN]        = {NULL  , NULL  , PREC_NONE  },
-    [TOKEN_LEFT_BRACE]         = {NULL  , NULL  , PREC_NONE  },
-    [TOKEN_RIGHT_BRACE]        = {NULL  , NULL  , PREC_NONE  },
-    [TOKEN_LEFT_SQUARE_BRACE]  = {NULL  , NULL  , PREC_NONE  },
-    [TOKEN_RIGHT_SQUARE_BRACE] = {NULL  , NULL  , PREC_NONE  },
-    [TOKEN_COMMA]              = {NULL  , NULL  , PREC_NONE  },
-    [TOKEN_DOT]                = {NULL  , NULL  , PREC_NONE  },
-    [TOKEN_SEMICOLON]          = {NULL  , NULL  , PREC_NONE  },
-    [TOKEN_COLON]              = {NULL  , NULL  , PREC_NONE  },
-    [TOKEN_PLUS]               = {NULL  , binary, PREC_TERM  },
-    [TOKEN_MINUS]              = {unary , binary, PREC_TERM  },
-    [TOKEN_STAR]               = {NULL  , binary, PREC_FACTOR},
-    [TOKEN_SLASH]              = {NULL  , binary, PREC_FACTOR},
-    [TOKEN_EQUAL]              = {NULL  , NULL  , PREC_NONE  },
-    [TOKEN_EQUAL_EQUAL]        = {NULL  , NULL  , PREC_NONE  },
-    [TOKEN_BANG]               = {NULL  , NULL  , PREC_NONE  },
-    [TOKEN_BANG_EQUAL]         = {NULL  , NULL  , PREC_NONE  },
-    [TOKEN_MORE]               = {NULL  , NULL  , PREC_NONE  },
-    [TOKEN_MORE_EQUAL]         = {NULL  , NULL  , PREC_NONE  },
-    [TOKEN_LESS]               = {NULL  , NULL  , PREC_NONE  },
-    [TOKEN_LESS_EQUAL]         = {NULL  , NULL  , PREC_NONE  },
-    [TOKEN_IDENTIFIER]         = {NULL  , NULL  , PREC_NONE  },
-    [TOKEN_NUMBER]             = {number, NULL  , PREC_NONE  },
-    [TOKEN_STRING]             = {NULL  , NULL  , PREC_NONE  },
-    [TOKEN_AND]                = {NULL  , NULL  , PREC_NONE  },
-    [TOKEN_OR]                 = {NULL  , NULL  , PREC_NONE  },
-    [TOKEN_NOT]                = {NULL  , NULL  , PREC_NONE  },
-    [TOKEN_VAR]                = {NULL  , NULL  , PREC_NONE  },
-    [TOKEN_CONST]              = {NULL  , NULL  , PREC_NONE  },
-    [TOKEN_FUN]                = {NULL  , NULL  , PREC_NONE  },
-    [TOKEN_CLASS]              = {NULL  , NULL  , PREC_NONE  },
-    [TOKEN_NIL]                = {NULL  , NULL  , PREC_NONE  },
-    [TOKEN_THIS]               = {NULL  , NULL  , PREC_NONE  },
-    [TOKEN_SUPER]              = {NULL  , NULL  , PREC_NONE  },
-    [TOKEN_TRUE]               = {NULL  , NULL  , PREC_NONE  },
-    [TOKEN_FALSE]              = {NULL  , NULL  , PREC_NONE  },
-    [TOKEN_IF]                 = {NULL  , NULL  , PREC_NONE  },
-    [TOKEN_ELSE]               = {NULL  , NULL  , PREC_NONE  },
-    [TOKEN_FOR]                = {NULL  , NULL  , PREC_NONE  },
-    [TOKEN_WHILE]              = {NULL  , NULL  , PREC_NONE  },
-    [TOKEN_EOF]                = {NULL  , NULL  , PREC_NONE  },
-    [TOKEN_ERROR]              = {NULL  , NULL  , PREC_NONE  },
-};
-
-ParseRule getRule(TokenType type)
-{
-    return rules[type];
-}
-
-void parsePrecedence(Compiler* comp, Precedence p)
+// the binding power of the infix operators, every other token ends an expression.
+Precedence infixPrecedence(TokenType type)
 {
-    nextToken(comp);
-    parseFn prefix = getRule(comp->previous.type).prefix;
-    if(prefix == NULL)
+    switch(type)
     {
-        errorAtCurrent(comp, "Expected expression");
-        return;
+        case TOKEN_PLUS:
+        case TOKEN_MINUS: return PREC_TERM;
+        case TOKEN_STAR:
+        case TOKEN_SLASH: return PREC_FACTOR;
+        default         : return PREC_NONE;
     }
-
-    prefix(comp);
-
-    while(p <= getRule(comp->current.type).precedence)
-    {
-        nextToken(comp);
-        getRule(comp->previous.type).infix(comp);
-    }
-}
-
-void expression(Compiler* comp)
-{
-    parsePrecedence(comp, PREC_ASSIGNMENT);
 }
 
 void number(Compiler* comp)
 {
-    double value = strtod(comp->previous.start, NULL);
+    double value = parseNumber(comp->previous.start, comp->previous.length);
     emitConstant(comp, value);
 }
 
-void group(Compiler* comp)
+void input(Compiler* comp)
 {
-    expression(comp);
-    consume(comp, TOKEN_RIGHT_PAREN, "Expected ')' after expression");
+    Token name = comp->previous;
+    int index = 0;
+    while(index < comp->inputCount && (strlen(comp->inputs[index]) != name.length || memcmp(comp->inputs[index], name.start, name.length)))
+        index++;
+
+    if(index == comp->inputCount)
+    {
+        errorAtCurrent(comp, "Unknown input");
+        return;
+    }
+    if(comp->chunk->type != CHUNK_STACK)
+    {
+        errorAtCurrent(comp, "Inputs are only supported in stack chunks");
+        return;
+    }
+    emitBytes(comp, OP_INPUT, (uint8_t)index);
 }
 
-void unary(Compiler* comp)
+typedef enum PendingType
+{
+    PENDING_GROUP,  // consume the ')'.
+    PENDING_UNARY,  // emit OP_NEGATE.
+    PENDING_BINARY, // emit the operator.
+} PendingType;
+
+// an operand that is being parsed: what to do once it is done, and the precedence of the
+// expression it is part of, which goes on with its infix operators after that.
+typedef struct Pending
+{
+    PendingType type;
+    TokenType operator;
+    Precedence precedence;
+} Pending;
+
+// makes room for one more pending operand and returns it.
+Pending* pushPending(Compiler* comp, Pending** pending, size_t* count, size_t* capacity)
 {
-    TokenType operator = comp->previous.type;
-    parsePrecedence(comp, PREC_UNARY);
-    switch(operator)
+    if(*count == *capacity)
     {
-        case TOKEN_MINUS: emitByte(comp, OP_NEGATE); break;
+        size_t newCapacity = *capacity < 8 ? 8 : *capacity * 2;
+        *pending = (Pending*)reallocate(comp->allocator, *pending, *capacity * sizeof(Pending), newCapacity * sizeof(Pending));
+        *capacity = newCapacity;
     }
+    return &(*pending)[(*count)++];
 }
 
-
-void binary(Compiler* comp)
+// a pratt parser that keeps the operators waiting for their operand on an explicit stack instead of
+// recursing, so nesting depth is only limited by memory. it emits the same code in the same order as
+// the recursive version: an operator after its operand, with the line of the operand's last token.
+void expression(Compiler* comp)
 {
-    TokenType operator = comp->previous.type;
-    parsePrecedence(comp, (Precedence)(getRule(operator).precedence + 1));
-    switch(operator)
+    Pending* pending = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    Precedence precedence = PREC_ASSIGNMENT;
+
+    while(true)
     {
-        case TOKEN_PLUS : emitByte(comp, OP_ADD     ); break;
-        case TOKEN_MINUS: emitByte(comp, OP_SUBTRACT); break;
-        case TOKEN_STAR : emitByte(comp, OP_MULTIPLY); break;
-        case TOKEN_SLASH: emitByte(comp, OP_DIVIDE  ); break;
+        // prefix: starts an operand of precedence.
+        nextToken(comp);
+        TokenType type = comp->previous.type;
+        if(type == TOKEN_LEFT_PAREN || type == TOKEN_MINUS)
+        {
+            Pending* operand = pushPending(comp, &pending, &count, &capacity);
+            operand->type = type == TOKEN_LEFT_PAREN ? PENDING_GROUP : PENDING_UNARY;
+            operand->operator = type;
+            operand->precedence = precedence;
+            precedence = type == TOKEN_LEFT_PAREN ? PREC_ASSIGNMENT : PREC_UNARY;
+            continue;
+        }
+
+        // an operand that is not an expression ends without its infix operators.
+        bool infix = true;
+        if(type == TOKEN_NUMBER)
+            number(comp);
+        else if(type == TOKEN_IDENTIFIER)
+            input(comp);
+        else
+        {
+            errorAtCurrent(comp, "Expected expression");
+            infix = false;
+        }
+
+        while(true)
+        {
+            // infix: the next operator binds if it is strong enough, its right operand is the next operand.
+            if(infix && precedence <= infixPrecedence(comp->current.type))
+            {
+                nextToken(comp);
+                Pending* operand = pushPending(comp, &pending, &count, &capacity);
+                operand->type = PENDING_BINARY;
+                operand->operator = comp->previous.type;
+                operand->precedence = precedence;
+                precedence = (Precedence)(infixPrecedence(comp->previous.type) + 1);
+                break;
+            }
+
+            if(count == 0)
+            {
+                reallocate(comp->allocator, pending, capacity * sizeof(Pending), 0);
+                return;
+            }
+
+            // the operand is done: finish what waited for it, then go on with the infix operators around it.
+            Pending* done = &pending[--count];
+            precedence = done->precedence;
+            infix = true;
+            switch(done->type)
+            {
+                case PENDING_GROUP:
+                    consume(comp, TOKEN_RIGHT_PAREN, "Expected ')' after expression");
+                    break;
+                case PENDING_UNARY:
+                    emitOperator(comp, OP_NEGATE);
+                    break;
+                case PENDING_BINARY:
+                    switch(done->operator)
+                    {
+                        case TOKEN_PLUS : emitOperator(comp, OP_ADD     ); break;
+                        case TOKEN_MINUS: emitOperator(comp, OP_SUBTRACT); break;
+                        case TOKEN_STAR : emitOperator(comp, OP_MULTIPLY); break;
+                        case TOKEN_SLASH: emitOperator(comp, OP_DIVIDE  ); break;
+                        default: break;
+                    }
+                    break;
+            }
+        }
     }
 }
 
@@ -238,13 +509,39 @@ Result compile(Compiler* comp, const char* source, Chunk* chunk)
     initScanner(&scanner, source);
     comp->scanner = &scanner;
     comp->chunk = chunk;
+    comp->allocator = chunk->allocator;
+
+    // guesses from the length of the source, so big sources do not grow the chunk many times.
+    size_t length = strlen(source);
+    reserveChunk(chunk, length / 4 + 16, length / 16 + 8, length / 64 + 8);
 
     nextToken(comp);
     expression(comp);
-
     consume(comp, TOKEN_EOF, "Expected end of file");
     freeScanner(&scanner);
-    emitByte(comp, OP_RETURN);
+
+    // the register vm has REGISTER_MAX registers, a deeper expression is compiled again to a stack chunk.
+    if(comp->tooDeep && !comp->error)
+    {
+        truncateChunk(chunk, 0);
+        while(chunk->values.size)
+            removeLastValue(&chunk->values);
+        memset(comp->references, 0, comp->referencesCapacity * sizeof(uint32_t));
+        chunk->type = CHUNK_STACK;
+        comp->panic = false;
+        comp->tooDeep = false;
+        comp->operandCount = 0;
+        comp->registerCount = 0;
+        comp->constantCount = 0;
+
+        initScanner(&scanner, source);
+        nextToken(comp);
+        expression(comp);
+        consume(comp, TOKEN_EOF, "Expected end of file");
+        freeScanner(&scanner);
+    }
+    emitReturn(comp);
+    chunk->maxStack = measureStack(chunk);
 
     if(comp->error)
         return RESULT_COMPILE_ERROR;
@@ -3,67 +3,145 @@
 #include <stdbool.h>
 #include "chunk.h"
 
-int disassembleSimpleInstruction(const char* name, int offset)
+int disassembleSimpleInstruction(OutputBuffer* out, const char* name, int offset)
 {
-	printf("%s\n", name);
+	writeString(out, name);
+	writeChar(out, '\n');
 	return 1;
 }
 
-int disassembleConstantInstruction(const char* name, int offset, Chunk* chunk, bool big)
+int disassembleConstantInstruction(OutputBuffer* out, const char* name, int offset, Chunk* chunk, bool big)
 {
-	printf("%s %i : ", name, chunk->data[offset + 1]);
-
-	if(!big)
-	{
-		printValue(chunk->values.data[chunk->data[offset + 1]]);
-		printf("\n");
-		return 2;
-	}
-
-	printValue(chunk->values.data[chunk->data[offset + 1] * 0xff + chunk->data[offset + 2]]);
-	printf("\n");
-	return 3;
+	uint16_t constant = big ? readShort(chunk, offset + 1) : chunk->data[offset + 1];
+	writeFormat(out, "%s %i : ", name, constant);
+	writeValue(out, chunk->values.data[constant]);
+	writeChar(out, '\n');
+	return big ? 3 : 2;
 }
 
-int disassembleInstruction(Chunk* chunk, int offset)
+int disassembleInstruction(OutputBuffer* out, Chunk* chunk, int offset)
 {
-	printf("%04d ", offset);
+	writeFormat(out, "%04d ", offset);
 
 	if(offset > 0 && getLine(&chunk->lines, offset) == getLine(&chunk->lines, offset - 1))
-		printf("   | ");
+		writeString(out, "   | ");
 	else
-		printf("%4d ", getLine(&chunk->lines, offset));
+		writeFormat(out, "%4d ", getLine(&chunk->lines, offset));
 
 	switch (chunk->data[offset])
 	{
 	case OP_RETURN:
-		return disassembleSimpleInstruction("RETURN", offset);
+		return disassembleSimpleInstruction(out, "RETURN", offset);
 	case OP_CONSTANT:
-		return disassembleConstantInstruction("CONSTANT", offset, chunk, false);
+		return disassembleConstantInstruction(out, "CONSTANT", offset, chunk, false);
 	case OP_LONG_CONSTANT:
-		return disassembleConstantInstruction("LONG_CONSTANT", offset, chunk, true);
+		return disassembleConstantInstruction(out, "LONG_CONSTANT", offset, chunk, true);
 	case OP_NEGATE:
-		return disassembleSimpleInstruction("NEGATE", offset);
+		return disassembleSimpleInstruction(out, "NEGATE", offset);
 	case OP_ADD:
-		return disassembleSimpleInstruction("ADD", offset);
+		return disassembleSimpleInstruction(out, "ADD", offset);
 	case OP_SUBTRACT:
-		return disassembleSimpleInstruction("SUBTRACT", offset);
+		return disassembleSimpleInstruction(out, "SUBTRACT", offset);
 	case OP_MULTIPLY:
-		return disassembleSimpleInstruction("MULTIPLY", offset);
+		return disassembleSimpleInstruction(out, "MULTIPLY", offset);
 	case OP_DIVIDE:
-		return disassembleSimpleInstruction("DIVIDE", offset);
+		return disassembleSimpleInstruction(out, "DIVIDE", offset);
+	case OP_ADD_CONSTANT:
+		return disassembleConstantInstruction(out, "ADD_CONSTANT", offset, chunk, false);
+	case OP_SUBTRACT_CONSTANT:
+		return disassembleConstantInstruction(out, "SUBTRACT_CONSTANT", offset, chunk, false);
+	case OP_MULTIPLY_CONSTANT:
+		return disassembleConstantInstruction(out, "MULTIPLY_CONSTANT", offset, chunk, false);
+	case OP_DIVIDE_CONSTANT:
+		return disassembleConstantInstruction(out, "DIVIDE_CONSTANT", offset, chunk, false);
+	case OP_CONSTANT_CONSTANT:
+		writeFormat(out, "CONSTANT_CONSTANT %i, %i : ", chunk->data[offset + 1], chunk->data[offset + 2]);
+		writeValue(out, chunk->values.data[chunk->data[offset + 1]]);
+		writeString(out, ", ");
+		writeValue(out, chunk->values.data[chunk->data[offset + 2]]);
+		writeChar(out, '\n');
+		return 3;
+	case OP_INPUT:
+		writeFormat(out, "INPUT %i\n", chunk->data[offset + 1]);
+		return 2;
+	default:
+		writeFormat(out, "unknown opCode: %i\n", chunk->data[offset]);
+		return 1;
+	}
+}
+
+void disassembleOperand(OutputBuffer* out, Chunk* chunk, uint16_t operand)
+{
+	if(!(operand & RK_CONSTANT))
+	{
+		writeFormat(out, " r%i", operand);
+		return;
+	}
+
+	writeFormat(out, " k%i(", operand & ~RK_CONSTANT);
+	writeValue(out, chunk->values.data[operand & ~RK_CONSTANT]);
+	writeChar(out, ')');
+}
+
+// name destination, source... with operands sources.
+int disassembleRegisterOperation(OutputBuffer* out, const char* name, int offset, Chunk* chunk, int operands)
+{
+	writeFormat(out, "%s r%i", name, chunk->data[offset + 1]);
+	for(int i = 0; i < operands; i++)
+	{
+		writeChar(out, ',');
+		disassembleOperand(out, chunk, readShort(chunk, offset + 2 + i * 2));
+	}
+	writeChar(out, '\n');
+	return 2 + operands * 2;
+}
+
+int disassembleRegisterInstruction(OutputBuffer* out, Chunk* chunk, int offset)
+{
+	writeFormat(out, "%04d ", offset);
+
+	if(offset > 0 && getLine(&chunk->lines, offset) == getLine(&chunk->lines, offset - 1))
+		writeString(out, "   | ");
+	else
+		writeFormat(out, "%4d ", getLine(&chunk->lines, offset));
+
+	switch (chunk->data[offset])
+	{
+	case ROP_RETURN:
+		writeString(out, "RETURN");
+		disassembleOperand(out, chunk, readShort(chunk, offset + 1));
+		writeChar(out, '\n');
+		return 3;
+	case ROP_LOAD:
+		writeFormat(out, "LOAD r%i,", chunk->data[offset + 1]);
+		disassembleOperand(out, chunk, readShort(chunk, offset + 2) | RK_CONSTANT);
+		writeChar(out, '\n');
+		return 4;
+	case ROP_NEGATE:
+		return disassembleRegisterOperation(out, "NEGATE", offset, chunk, 1);
+	case ROP_ADD:
+		return disassembleRegisterOperation(out, "ADD", offset, chunk, 2);
+	case ROP_SUBTRACT:
+		return disassembleRegisterOperation(out, "SUBTRACT", offset, chunk, 2);
+	case ROP_MULTIPLY:
+		return disassembleRegisterOperation(out, "MULTIPLY", offset, chunk, 2);
+	case ROP_DIVIDE:
+		return disassembleRegisterOperation(out, "DIVIDE", offset, chunk, 2);
 	default:
-		printf("unknown opCode: %i\n", chunk->data[offset]);
+		writeFormat(out, "unknown opCode: %i\n", chunk->data[offset]);
 		return 1;
 	}
 }
 
-void disassembleChunk(Chunk* chunk, const char* name)
+void disassembleChunk(OutputBuffer* out, Chunk* chunk, const char* name)
 {
-	printf("==== disassembly: %s | instructions: %i ====\n", name, chunk->size);
+	writeFormat(out, "==== disassembly: %s | instructions: %zu ====\n", name, chunk->size);
 
-	for(int i = 0; i < chunk->size; i += disassembleInstruction(chunk, i));
-	printf("============ end of dissasembly ============\n\n");
+	if(chunk->type == CHUNK_REGISTER)
+		for(int i = 0; i < chunk->size; i += disassembleRegisterInstruction(out, chunk, i));
+	else
+		for(int i = 0; i < chunk->size; i += disassembleInstruction(out, chunk, i));
+	writeString(out, "============ end of dissasembly ============\n\n");
 }
 
-#endif
\ No newline at end of file
+#endif
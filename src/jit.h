@@ -0,0 +1,222 @@
+#ifndef JIT_H
+#define JIT_H
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "vm.h"
+
+// translates stack chunks to x86-64 machine code. stack slot i lives in xmm i, so chunks that need
+// more than JIT_STACK_MAX values, register chunks and other machines are run by the interpreter.
+// the code is called as double f(const Value* constants, const Value* inputs), system v abi:
+// constants in rdi, inputs in rsi, the result in xmm0. xmm15 is scratch.
+
+#if defined(__x86_64__) && defined(__unix__) && !defined(NO_JIT)
+#define JIT
+#endif
+
+#define JIT_STACK_MAX 15
+#define JIT_INSTRUCTION_MAX 20 // most machine code bytes per bytecode byte (NEGATE: 10 + 5 + 5).
+
+typedef double (*JitFunction)(const Value* constants, const Value* inputs);
+
+typedef struct JitCode
+{
+	uint8_t* code;
+	size_t size;
+	size_t capacity; // of the mapping.
+	bool full; // an emit did not fit in the mapping, the translation is dropped.
+	JitFunction function; // NULL when the chunk could not be translated.
+} JitCode;
+
+void initJit(JitCode* jit)
+{
+	jit->code = NULL;
+	jit->size = 0;
+	jit->capacity = 0;
+	jit->full = false;
+	jit->function = NULL;
+}
+
+void freeJit(JitCode* jit)
+{
+	if(jit->code)
+		munmap(jit->code, jit->capacity);
+	initJit(jit);
+}
+
+void emitJitByte(JitCode* jit, uint8_t byte)
+{
+	if(jit->size == jit->capacity)
+	{
+		jit->full = true;
+		return;
+	}
+	jit->code[jit->size++] = byte;
+}
+
+void emitJitInt(JitCode* jit, uint32_t value)
+{
+	for(int i = 0; i < 4; i++)
+		emitJitByte(jit, (uint8_t)(value >> i * 8));
+}
+
+// prefix, optional rex, 0f op, mod rm for xmm reg and xmm rm.
+void emitJitRegisters(JitCode* jit, uint8_t prefix, uint8_t op, int reg, int rm)
+{
+	emitJitByte(jit, prefix);
+	if(reg >= 8 || rm >= 8)
+		emitJitByte(jit, 0x40 | (reg >= 8) << 2 | (rm >= 8));
+	emitJitByte(jit, 0x0f);
+	emitJitByte(jit, op);
+	emitJitByte(jit, 0xc0 | (reg & 7) << 3 | (rm & 7));
+}
+
+// scalar double op with xmm reg and the value at base + index * 8, base is 7 (rdi) or 6 (rsi).
+void emitJitMemory(JitCode* jit, uint8_t op, int reg, int base, uint32_t index)
+{
+	emitJitByte(jit, 0xf2);
+	if(reg >= 8)
+		emitJitByte(jit, 0x44);
+	emitJitByte(jit, 0x0f);
+	emitJitByte(jit, op);
+	emitJitByte(jit, 0x80 | (reg & 7) << 3 | base);
+	emitJitInt(jit, index * sizeof(Value));
+}
+
+#define JIT_MOVSD 0x10
+#define JIT_ADDSD 0x58
+#define JIT_MULSD 0x59
+#define JIT_SUBSD 0x5c
+#define JIT_DIVSD 0x5e
+#define JIT_RDI 7
+#define JIT_RSI 6
+
+uint8_t jitOperation(uint8_t op)
+{
+	switch(op)
+	{
+		case OP_ADD: case OP_ADD_CONSTANT          : return JIT_ADDSD;
+		case OP_SUBTRACT: case OP_SUBTRACT_CONSTANT: return JIT_SUBSD;
+		case OP_MULTIPLY: case OP_MULTIPLY_CONSTANT: return JIT_MULSD;
+		default                                    : return JIT_DIVSD;
+	}
+}
+
+// translates chunk, returns false (and leaves jit->function NULL) if the interpreter has to run it.
+bool compileJit(JitCode* jit, Chunk* chunk)
+{
+	initJit(jit);
+#ifndef JIT
+	return false;
+#else
+	if(chunk->type != CHUNK_STACK || chunk->maxStack > JIT_STACK_MAX)
+		return false;
+
+	size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+	jit->capacity = (chunk->size * JIT_INSTRUCTION_MAX + pageSize) / pageSize * pageSize;
+	void* code = mmap(NULL, jit->capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(code == MAP_FAILED)
+	{
+		jit->capacity = 0;
+		return false;
+	}
+	jit->code = (uint8_t*)code;
+
+	int top = 0;
+	bool returned = false;
+	for(size_t i = 0; i < chunk->size; i += opCodeSize(chunk->data[i]))
+	{
+		uint8_t op = chunk->data[i];
+		switch(op)
+		{
+		case OP_RETURN:
+			if(top - 1 != 0)
+				emitJitRegisters(jit, 0x66, 0x28, 0, top - 1); // movapd xmm0, top.
+			emitJitByte(jit, 0xc3);
+			top--;
+			returned = true;
+			break;
+		case OP_CONSTANT:
+			emitJitMemory(jit, JIT_MOVSD, top++, JIT_RDI, chunk->data[i + 1]);
+			break;
+		case OP_LONG_CONSTANT:
+			emitJitMemory(jit, JIT_MOVSD, top++, JIT_RDI, readShort(chunk, i + 1));
+			break;
+		case OP_CONSTANT_CONSTANT:
+			emitJitMemory(jit, JIT_MOVSD, top++, JIT_RDI, chunk->data[i + 1]);
+			emitJitMemory(jit, JIT_MOVSD, top++, JIT_RDI, chunk->data[i + 2]);
+			break;
+		case OP_INPUT:
+			emitJitMemory(jit, JIT_MOVSD, top++, JIT_RSI, chunk->data[i + 1]);
+			break;
+		case OP_NEGATE:
+			// flip the sign bit like the interpreter, 0 - x would give 0 for -0.
+			emitJitByte(jit, 0x48); // mov rax, sign bit.
+			emitJitByte(jit, 0xb8);
+			emitJitInt(jit, 0);
+			emitJitInt(jit, 0x80000000);
+			emitJitByte(jit, 0x66); // movq xmm15, rax.
+			emitJitByte(jit, 0x4c);
+			emitJitByte(jit, 0x0f);
+			emitJitByte(jit, 0x6e);
+			emitJitByte(jit, 0xf8);
+			emitJitRegisters(jit, 0x66, 0x57, top - 1, 15); // xorpd top, xmm15.
+			break;
+		case OP_ADD:
+		case OP_SUBTRACT:
+		case OP_MULTIPLY:
+		case OP_DIVIDE:
+			emitJitRegisters(jit, 0xf2, jitOperation(op), top - 2, top - 1);
+			top--;
+			break;
+		case OP_ADD_CONSTANT:
+		case OP_SUBTRACT_CONSTANT:
+		case OP_MULTIPLY_CONSTANT:
+		case OP_DIVIDE_CONSTANT:
+			emitJitMemory(jit, jitOperation(op), top - 1, JIT_RDI, chunk->data[i + 1]);
+			break;
+		default:
+			freeJit(jit);
+			return false;
+		}
+
+		if(top < 0 || top > JIT_STACK_MAX || jit->full)
+		{
+			freeJit(jit);
+			return false;
+		}
+	}
+
+	if(!returned || jit->full || mprotect(jit->code, jit->capacity, PROT_READ | PROT_EXEC))
+	{
+		freeJit(jit);
+		return false;
+	}
+	jit->function = (JitFunction)jit->code;
+	return true;
+#endif
+}
+
+// runs chunk as machine code, or with the interpreter when it can not be translated.
+Result executeJit(VM* vm, Chunk* chunk)
+{
+	JitCode jit;
+	if(!compileJit(&jit, chunk))
+		return execute(vm, chunk);
+
+	writeValue(&vm->out, jit.function(chunk->values.data, vm->inputs));
+	writeChar(&vm->out, '\n');
+	freeJit(&jit);
+	return RESULT_OK;
+}
+
+#undef JIT_MOVSD
+#undef JIT_ADDSD
+#undef JIT_MULSD
+#undef JIT_SUBSD
+#undef JIT_DIVSD
+#undef JIT_RDI
+#undef JIT_RSI
+
+#endif
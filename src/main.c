@@ -3,18 +3,52 @@
 #include <string.h>
 #include "vm.h"
 #include "compiler.h"
+#include "optimizer.h"
+#include "bytecode.h"
+#include "cache.h"
+#include "columns.h"
+#include "jit.h"
+#include "native.h"
+#include "pool.h"
 #include "common.h"
 // todo: exe name (in usage)
 // todo: multi line input in repl
 
-char* readFile(const char* path)
+typedef struct Options
+{
+	bool bytecode; // print the disassembled chunk before running it.
+	bool trace; // run with runTraced(), written to stderr.
+	bool registers; // compile to a register chunk.
+	bool optimize; // run the peephole optimizer over the chunk.
+	bool jit; // run stack chunks as machine code, see jit.h.
+	bool profile; // run with runProfiled() and write where the time went to stderr.
+	const char* sample; // run with runSampled() and write the samples to this file as folded stacks.
+	const char* traceRing; // run with runRecorded() and dump the last instructions to this file, see traceRing.h.
+	const char* emitBytecode; // write the compiled chunk to this file instead of running it.
+	const char* emitC; // write the compiled chunk as c to this file instead of running it, see native.h.
+	const char* native; // run this shared object, compiled from --emit-c output, instead of a file.
+	bool batch; // evaluate every line of the file (or stdin) on its own.
+	Arena* arena; // holds the chunk and compiler data of one compilation.
+	bool memoryStats; // print how much of the arena a compilation used.
+	Cache* cache; // NULL when compiled chunks are not cached.
+	const char* columns; // csv file whose columns are the inputs, the expression is evaluated for every row.
+} Options;
+
+// the options that change the compiled chunk, part of the cache key.
+uint32_t compileFlags(Options* options)
+{
+	return (uint32_t)options->registers | (uint32_t)options->optimize << 1;
+}
+
+// returns the contents of the file, or NULL after writing why to errors.
+char* loadFile(const char* path, OutputBuffer* errors)
 {
 	FILE* f = fopen(path, "rb");
 
 	if(f == NULL)
 	{
-		fprintf(stderr, "could not open file: \"%s\".\n", path);
-		exit(74);
+		writeFormat(errors, "could not open file: \"%s\".\n", path);
+		return NULL;
 	}
 
 	fseek(f, 0L, SEEK_END);
@@ -29,50 +63,507 @@ char* readFile(const char* path)
 	}
 	if(fread(buffer, sizeof(char), size, f) < size)
 	{
-		fprintf(stderr, "could not read file: \"%s\".\n", path);
-		exit(74);
+		writeFormat(errors, "could not read file: \"%s\".\n", path);
+		fclose(f);
+		free(buffer);
+		return NULL;
 	}
+	fclose(f);
 
 	buffer[size] = '\0';
 	return buffer;
 }
 
-Result interpret(const char* source, bool disassemble)
+char* readFile(const char* path)
 {
-	Chunk chunk;
-	initChunk(&chunk);
+	OutputBuffer errors;
+	initOutputBuffer(&errors, stderr, 256);
+	char* buffer = loadFile(path, &errors);
+	freeOutputBuffer(&errors);
 
-	Compiler comp;
-	initCompiler(&comp);
+	if(!buffer)
+		exit(74);
+	return buffer;
+}
+
+// compiles source into an empty chunk, stats is only written with -O.
+Result compileSource(Compiler* comp, const char* source, Chunk* chunk, Options* options, OptimizerStats* stats)
+{
+	if(options->registers)
+		chunk->type = CHUNK_REGISTER;
+
+	Result r = compile(comp, source, chunk);
+	if(r == RESULT_OK && options->optimize)
+		*stats = optimizeChunk(chunk);
+	return r;
+}
 
-	if(compile(&comp, source, &chunk))
+// the run modes that only the stack vm has.
+bool needsStackChunk(Options* options)
+{
+	return options->trace || options->profile || options->sample || options->traceRing || options->jit;
+}
+
+Result runChunk(Chunk* chunk, Options* options)
+{
+	if(chunk->type == CHUNK_REGISTER && needsStackChunk(options))
 	{
-		freeChunk(&chunk);
-		return RESULT_COMPILE_ERROR;
+		fprintf(stderr, "--trace, --profile, --sample, --trace-ring and --jit need a stack chunk.\n");
+		return RESULT_IO_ERROR;
 	}
-
-	if(chunk.size == 0)
+	if(chunk->size == 0)
 		return RESULT_OK;
-	
-	if(disassemble)
-		disassembleChunk(&chunk, "main");
 
-	freeCompiler(&comp);
+	if(options->bytecode)
+	{
+		OutputBuffer out;
+		initOutputBuffer(&out, stdout, OUTPUT_BUFFER_SIZE);
+		disassembleChunk(&out, chunk, "main");
+		freeOutputBuffer(&out);
+	}
 
 	VM vm;
 	initVM(&vm);
-	loadChunk(&vm, &chunk);
+	loadChunk(&vm, chunk);
 
-	Result r = run(&vm);
-	
+	Result r;
+	if(chunk->type == CHUNK_REGISTER)
+		r = runRegisters(&vm);
+	else if(options->trace)
+	{
+		OutputBuffer trace;
+		initOutputBuffer(&trace, stderr, OUTPUT_BUFFER_SIZE);
+		vm.trace = &trace;
+		r = runTraced(&vm);
+		freeOutputBuffer(&trace);
+	}
+	else if(options->profile)
+	{
+		Profile profile;
+		initProfile(&profile);
+		vm.profile = &profile;
+		r = runProfiled(&vm);
+		flushOutputBuffer(&vm.out);
+
+		OutputBuffer report;
+		initOutputBuffer(&report, stderr, OUTPUT_BUFFER_SIZE);
+		writeProfile(&report, &profile);
+		freeOutputBuffer(&report);
+		freeProfile(&profile);
+	}
+	else if(options->sample)
+	{
+		Sampler sampler;
+		initSampler(&sampler);
+		vm.sampler = &sampler;
+		r = runSampled(&vm);
+		if(sampler.chunk && !writeSamplesFile(&sampler, "main", options->sample) && r == RESULT_OK)
+			r = RESULT_IO_ERROR;
+		freeSampler(&sampler);
+	}
+	else if(options->traceRing)
+	{
+		TraceRing ring;
+		initTraceRing(&ring);
+		if(!openTraceRing(&ring, chunk, options->traceRing))
+			r = RESULT_IO_ERROR;
+		else
+		{
+			vm.ring = &ring;
+			r = runRecorded(&vm);
+			if(!closeTraceRing(&ring))
+			{
+				fprintf(stderr, "could not write file: \"%s\".\n", options->traceRing);
+				if(r == RESULT_OK)
+					r = RESULT_IO_ERROR;
+			}
+		}
+	}
+	else if(options->jit)
+		r = executeJit(&vm, chunk);
+	else
+		r = run(&vm);
+
+	freeVM(&vm);
+	return r;
+}
+
+Result interpret(const char* source, Options* options)
+{
+	Chunk chunk;
+	Result r = RESULT_OK;
+
+	if(!options->cache || !loadCachedChunk(options->cache, source, compileFlags(options), &chunk))
+	{
+		resetArena(options->arena);
+		reserveArena(options->arena, strlen(source) * 2);
+		initChunkWithAllocator(&chunk, &options->arena->allocator);
+		Compiler comp;
+		initCompiler(&comp);
+		OptimizerStats stats;
+		r = compileSource(&comp, source, &chunk, options, &stats);
+		freeCompiler(&comp);
+
+		if(r == RESULT_OK && options->optimize)
+			fprintf(stderr, "optimizer: removed %zu bytes, %zu instructions\n", stats.bytesRemoved, stats.instructionsRemoved);
+		if(options->memoryStats)
+			fprintf(stderr, "memory: %zu bytes, %zu block allocations\n", options->arena->peak, options->arena->blockAllocations);
+		if(r == RESULT_OK && options->cache)
+			storeCachedChunk(options->cache, source, compileFlags(options), &chunk);
+	}
+
+	if(r == RESULT_OK)
+	{
+		if(options->emitBytecode)
+			r = writeBytecodeFile(&chunk, options->emitBytecode) ? RESULT_OK : RESULT_IO_ERROR;
+		else if(options->emitC)
+			r = writeCFile(&chunk, NULL, 0, options->emitC) ? RESULT_OK : RESULT_IO_ERROR;
+		else
+			r = runChunk(&chunk, options);
+	}
+
+	freeChunk(&chunk);
+	return r;
+}
+
+// evaluates every line of in as an expression and writes one result line for each.
+// the chunk and compiler data are in the arena, which is reset for every line, the vm is reused
+// and the results are collected in its output buffer.
+Result runBatch(FILE* in, Options* options)
+{
+	Chunk chunk;
+	Compiler comp;
+	VM vm;
+	initVM(&vm);
+
+	OptimizerStats total = { 0, 0 };
+	Result r = RESULT_OK;
+	char* line = NULL;
+	size_t capacity = 0;
+	ssize_t length;
+
+	while((length = getline(&line, &capacity, in)) > 0)
+	{
+		if(length == 1 && line[0] == '\n')
+			continue;
+
+		resetArena(options->arena);
+		initChunkWithAllocator(&chunk, &options->arena->allocator);
+		initCompiler(&comp);
+		OptimizerStats stats = { 0, 0 };
+		if(compileSource(&comp, line, &chunk, options, &stats))
+		{
+			// keep one output line for every expression.
+			writeString(&vm.out, "error\n");
+			r = RESULT_COMPILE_ERROR;
+			continue;
+		}
+		total.bytesRemoved += stats.bytesRemoved;
+		total.instructionsRemoved += stats.instructionsRemoved;
+
+		resetVM(&vm);
+		if(execute(&vm, &chunk))
+			r = RESULT_RUNTIME_ERROR;
+	}
+
+	if(options->optimize)
+		fprintf(stderr, "optimizer: removed %zu bytes, %zu instructions\n", total.bytesRemoved, total.instructionsRemoved);
+	if(options->memoryStats)
+		fprintf(stderr, "memory: %zu bytes at most, %zu block allocations\n", options->arena->peak, options->arena->blockAllocations);
+
+	free(line);
 	freeVM(&vm);
+	return r;
+}
+
+// compiles the expression in path once, with the columns of options->columns as its inputs,
+// and writes its value for every row.
+Result runColumns(const char* path, Options* options)
+{
+	Columns columns;
+	initColumns(&columns);
+	char* text = readFile(options->columns);
+	bool read = readColumns(&columns, text);
+	free(text);
+
+	if(!read || columns.count > INPUT_MAX)
+	{
+		if(read)
+			fprintf(stderr, "at most %d columns can be used as inputs.\n", INPUT_MAX);
+		fprintf(stderr, "could not read columns: \"%s\".\n", options->columns);
+		freeColumns(&columns);
+		return RESULT_IO_ERROR;
+	}
+
+	char* source = readFile(path);
+	Chunk chunk;
+	initChunk(&chunk);
+	Compiler comp;
+	initCompiler(&comp);
+	comp.inputs = (const char* const*)columns.names;
+	comp.inputCount = (int)columns.count;
+	OptimizerStats stats;
+	Result r = compileSource(&comp, source, &chunk, options, &stats);
+	freeCompiler(&comp);
+	free(source);
+
+	if(r == RESULT_OK && options->emitC)
+		r = writeCFile(&chunk, comp.inputs, comp.inputCount, options->emitC) ? RESULT_OK : RESULT_IO_ERROR;
+	else if(r == RESULT_OK)
+	{
+		Value* results = (Value*)reallocate(&heapAllocator, NULL, 0, columns.rows * sizeof(Value));
+		JitCode jit;
+		if(options->jit && compileJit(&jit, &chunk))
+		{
+			Value row[INPUT_MAX];
+			for(size_t i = 0; i < columns.rows; i++)
+			{
+				for(size_t j = 0; j < columns.count; j++)
+					row[j] = columns.data[j][i];
+				results[i] = jit.function(chunk.values.data, row);
+			}
+			freeJit(&jit);
+		}
+		else
+			r = evaluateColumns(&chunk, columns.data, columns.rows, results);
+
+		OutputBuffer out;
+		initOutputBuffer(&out, stdout, OUTPUT_BUFFER_SIZE);
+		for(size_t i = 0; r == RESULT_OK && i < columns.rows; i++)
+		{
+			writeValue(&out, results[i]);
+			writeChar(&out, '\n');
+		}
+		freeOutputBuffer(&out);
+		reallocate(&heapAllocator, results, columns.rows * sizeof(Value), 0);
+	}
+
+	freeChunk(&chunk);
+	freeColumns(&columns);
+	return r;
+}
+
+// runs a compiled --emit-c expression, for every row of options->columns when it has inputs.
+Result runNative(Options* options)
+{
+	NativeCode native;
+	if(!loadNative(&native, options->native))
+		return RESULT_IO_ERROR;
+
+	OutputBuffer out;
+	initOutputBuffer(&out, stdout, OUTPUT_BUFFER_SIZE);
+	Result r = RESULT_OK;
+
+	if(!native.inputCount)
+	{
+		writeValue(&out, native.function(NULL));
+		writeChar(&out, '\n');
+	}
+	else if(!options->columns)
+	{
+		fprintf(stderr, "the expression has inputs, give them with --columns.\n");
+		r = RESULT_IO_ERROR;
+	}
+	else
+	{
+		Columns columns;
+		initColumns(&columns);
+		char* text = readFile(options->columns);
+		if(!readColumns(&columns, text))
+			r = RESULT_IO_ERROR;
+		free(text);
+
+		// the columns the inputs of the expression are in.
+		size_t* sources = (size_t*)reallocate(&heapAllocator, NULL, 0, native.inputCount * sizeof(size_t));
+		for(int i = 0; r == RESULT_OK && i < native.inputCount; i++)
+		{
+			for(sources[i] = 0; sources[i] < columns.count && strcmp(columns.names[sources[i]], native.inputs[i]); sources[i]++);
+			if(sources[i] == columns.count)
+			{
+				fprintf(stderr, "no column named \"%s\" in \"%s\".\n", native.inputs[i], options->columns);
+				r = RESULT_IO_ERROR;
+			}
+		}
+
+		Value* row = (Value*)reallocate(&heapAllocator, NULL, 0, native.inputCount * sizeof(Value));
+		for(size_t i = 0; r == RESULT_OK && i < columns.rows; i++)
+		{
+			for(int j = 0; j < native.inputCount; j++)
+				row[j] = columns.data[sources[j]][i];
+			writeValue(&out, native.function(row));
+			writeChar(&out, '\n');
+		}
+
+		reallocate(&heapAllocator, row, native.inputCount * sizeof(Value), 0);
+		reallocate(&heapAllocator, sources, native.inputCount * sizeof(size_t), 0);
+		freeColumns(&columns);
+	}
+
+	freeOutputBuffer(&out);
+	freeNative(&native);
+	return r;
+}
+
+typedef struct FileJob
+{
+	const char* path;
+	OutputBuffer out; // results and errors, written in input order once every file is done.
+	OutputBuffer errors;
+	Result result;
+} FileJob;
+
+typedef struct FileJobs
+{
+	FileJob* jobs;
+	Arena* arenas; // one for every worker.
+	Options* options;
+} FileJobs;
+
+// compiles and runs one file of runFiles(), with a compiler, chunk and vm of its own.
+void runFileJob(void* context, size_t index, int worker)
+{
+	FileJobs* files = (FileJobs*)context;
+	FileJob* job = &files->jobs[index];
+	Options* options = files->options;
+	Chunk chunk;
+
+	if(isBytecodeFile(job->path))
+	{
+		if(!loadBytecodeFile(&chunk, job->path))
+		{
+			job->result = RESULT_IO_ERROR;
+			return;
+		}
+	}
+	else
+	{
+		char* source = loadFile(job->path, &job->errors);
+		if(!source)
+		{
+			job->result = RESULT_IO_ERROR;
+			return;
+		}
+
+		Arena* arena = &files->arenas[worker];
+		resetArena(arena);
+		initChunkWithAllocator(&chunk, &arena->allocator);
+		Compiler comp;
+		initCompiler(&comp);
+		comp.errors = &job->errors;
+		OptimizerStats stats;
+		job->result = compileSource(&comp, source, &chunk, options, &stats);
+		freeCompiler(&comp);
+		free(source);
+
+		if(job->result)
+		{
+			freeChunk(&chunk);
+			return;
+		}
+	}
+
+	if(chunk.type == CHUNK_REGISTER && options->jit)
+	{
+		writeFormat(&job->errors, "--jit needs a stack chunk: \"%s\".\n", job->path);
+		job->result = RESULT_IO_ERROR;
+	}
+	else if(chunk.size)
+	{
+		VM vm;
+		initVM(&vm);
+		vm.out.file = NULL;
+		job->result = options->jit ? executeJit(&vm, &chunk) : execute(&vm, &chunk);
+		writeBytes(&job->out, vm.out.data, vm.out.size);
+		freeVM(&vm);
+	}
 	freeChunk(&chunk);
+}
+
+// runs every file on workers threads, the output is the same as running them one after another.
+Result runFiles(const char** paths, size_t count, Options* options, int workers)
+{
+	FileJob* jobs = (FileJob*)reallocate(&heapAllocator, NULL, 0, count * sizeof(FileJob));
+	for(size_t i = 0; i < count; i++)
+	{
+		jobs[i].path = paths[i];
+		initOutputBuffer(&jobs[i].out, NULL, 256);
+		initOutputBuffer(&jobs[i].errors, NULL, 256);
+		jobs[i].result = RESULT_OK;
+	}
 
+	Arena* arenas = (Arena*)reallocate(&heapAllocator, NULL, 0, workers * sizeof(Arena));
+	for(int i = 0; i < workers; i++)
+		initArena(&arenas[i], ARENA_BLOCK_SIZE);
+
+	FileJobs files = { jobs, arenas, options };
+	runJobs(count, workers, runFileJob, &files);
+
+	Result r = RESULT_OK;
+	for(size_t i = 0; i < count; i++)
+	{
+		jobs[i].errors.file = stderr;
+		freeOutputBuffer(&jobs[i].errors);
+		jobs[i].out.file = stdout;
+		freeOutputBuffer(&jobs[i].out);
+		if(!r)
+			r = jobs[i].result;
+	}
+
+	for(int i = 0; i < workers; i++)
+		freeArena(&arenas[i]);
+	reallocate(&heapAllocator, arenas, workers * sizeof(Arena), 0);
+	reallocate(&heapAllocator, jobs, count * sizeof(FileJob), 0);
 	return r;
 }
 
+// adds path to files, or the files in it (sorted by name) when it is a directory.
+void addFiles(const char* path, char*** files, size_t* count, size_t* capacity)
+{
+	struct stat st;
+	struct dirent** entries = NULL;
+	int entryCount = 0;
+	bool directory = !stat(path, &st) && S_ISDIR(st.st_mode);
+	if(directory && (entryCount = scandir(path, &entries, NULL, alphasort)) < 0)
+	{
+		fprintf(stderr, "could not read directory: \"%s\".\n", path);
+		exit(RESULT_IO_ERROR);
+	}
+
+	for(int i = 0; i < (directory ? entryCount : 1); i++)
+	{
+		char* file;
+		if(directory)
+		{
+			const char* name = entries[i]->d_name;
+			bool hidden = name[0] == '.';
+			char* joined = (char*)malloc(strlen(path) + strlen(name) + 2);
+			if(joined)
+				sprintf(joined, "%s/%s", path, name);
+			free(entries[i]);
+
+			if(hidden || !joined || stat(joined, &st) || !S_ISREG(st.st_mode))
+			{
+				free(joined);
+				continue;
+			}
+			file = joined;
+		}
+		else
+			file = strdup(path);
+
+		if(*count == *capacity)
+		{
+			size_t oldCapacity = *capacity;
+			*capacity = *capacity < 8 ? 8 : *capacity * 2;
+			*files = (char**)reallocate(&heapAllocator, *files, oldCapacity * sizeof(char*), *capacity * sizeof(char*));
+		}
+		(*files)[(*count)++] = file;
+	}
+	free(entries);
+}
+
 // TODO: multi line input
-void repl()
+void repl(Options* options)
 {
 	char line[1024];
 	while(true)
@@ -80,17 +571,35 @@ void repl()
 		printf("> ");
 		
 		if(fgets(line, sizeof(line), stdin))
-			interpret(line, false);
+			interpret(line, options);
 		else
 			printf(" \n");
 	}
 }
 
-void runFile(const char* path, bool bytecode)
+void runFile(const char* path, Options* options)
 {
-	char* source = readFile(path);
-	Result r = interpret(source, bytecode);
-	free(source);
+	Result r;
+	if(options->columns)
+		r = runColumns(path, options);
+	else if(isBytecodeFile(path))
+	{
+		Chunk chunk;
+		if(!loadBytecodeFile(&chunk, path))
+			exit(RESULT_IO_ERROR);
+
+		r = runChunk(&chunk, options);
+		freeChunk(&chunk);
+	}
+	else
+	{
+		char* source = readFile(path);
+		r = interpret(source, options);
+		free(source);
+	}
+
+	if(options->cache)
+		freeCache(options->cache);
 
 	if(r)
 		exit((int)r);
@@ -98,33 +607,156 @@ void runFile(const char* path, bool bytecode)
 
 int main(int argc, char const *argv[])
 {
-	if(argc == 1)
-		repl();
-	
-	bool bytecode = false;
-	const char* file;
-	bool fileSet = false;
+	Options options = { 0 };
+	const char** paths = (const char**)reallocate(&heapAllocator, NULL, 0, argc * sizeof(char*));
+	int pathCount = 0;
+	int workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+	bool cache = false;
+	bool cacheStats = false;
+	const char* cacheDirectory = NULL;
+	const char* decodeTrace = NULL;
+	size_t cacheSize = CACHE_DEFAULT_SIZE;
 
 	for(int i = 1; i < argc; i++)
 	{
 		if(!strcmp(argv[i], "--bytecode"))
-			bytecode = true;
+			options.bytecode = true;
+		else if(!strcmp(argv[i], "--trace"))
+			options.trace = true;
+		else if(!strcmp(argv[i], "--registers"))
+			options.registers = true;
+		else if(!strcmp(argv[i], "-O"))
+			options.optimize = true;
+		else if(!strcmp(argv[i], "--jit"))
+			options.jit = true;
+		else if(!strcmp(argv[i], "--profile"))
+			options.profile = true;
+		else if(!strcmp(argv[i], "--sample") && i + 1 < argc)
+			options.sample = argv[++i];
+		else if(!strcmp(argv[i], "--trace-ring") && i + 1 < argc)
+			options.traceRing = argv[++i];
+		else if(!strcmp(argv[i], "--decode-trace") && i + 1 < argc)
+			decodeTrace = argv[++i];
+		else if(!strcmp(argv[i], "--emit-c") && i + 1 < argc)
+			options.emitC = argv[++i];
+		else if(!strcmp(argv[i], "--native") && i + 1 < argc)
+			options.native = argv[++i];
+		else if(!strcmp(argv[i], "--emit-bytecode") && i + 1 < argc)
+			options.emitBytecode = argv[++i];
+		else if(!strcmp(argv[i], "--cache"))
+			cache = true;
+		else if(!strcmp(argv[i], "--cache-dir") && i + 1 < argc)
+		{
+			cache = true;
+			cacheDirectory = argv[++i];
+		}
+		else if(!strcmp(argv[i], "--cache-size") && i + 1 < argc)
+			cacheSize = strtoull(argv[++i], NULL, 10);
+		else if(!strcmp(argv[i], "--cache-stats"))
+			cacheStats = true;
+		else if(!strcmp(argv[i], "--batch"))
+			options.batch = true;
+		else if(!strcmp(argv[i], "--memory-stats"))
+			options.memoryStats = true;
+		else if(!strcmp(argv[i], "--columns") && i + 1 < argc)
+			options.columns = argv[++i];
+		else if(!strcmp(argv[i], "-j") && i + 1 < argc)
+			workers = atoi(argv[++i]);
 		else
+			paths[pathCount++] = argv[i];
+	}
+
+	bool fileSet = pathCount > 0;
+	const char* file = fileSet ? paths[0] : NULL;
+	if(options.registers && needsStackChunk(&options))
+	{
+		fprintf(stderr, "--trace, --profile, --sample, --trace-ring and --jit need a stack chunk.\n");
+		exit(RESULT_IO_ERROR);
+	}
+
+	struct stat st;
+	if(pathCount > 1 || (fileSet && !stat(file, &st) && S_ISDIR(st.st_mode)))
+	{
+		if(options.bytecode || options.trace || options.emitBytecode || options.emitC || options.batch || options.columns || options.sample || options.traceRing ||
+		   options.profile || cache || cacheStats || options.memoryStats)
 		{
-			if(!fileSet)
-			{
-				file = argv[i];
-				fileSet = true;
-			}
-			else
-				printf("Usage: name [filename]\n %d");
+			fprintf(stderr, "--bytecode, --trace, --emit-bytecode, --emit-c, --batch, --columns, --sample, --trace-ring, --profile, --cache and --memory-stats take one file.\n");
+			exit(RESULT_IO_ERROR);
 		}
+
+		char** files = NULL;
+		size_t count = 0;
+		size_t capacity = 0;
+		for(int i = 0; i < pathCount; i++)
+			addFiles(paths[i], &files, &count, &capacity);
+
+		Result r = runFiles((const char**)files, count, &options, workers < 1 ? 1 : workers);
+		for(size_t i = 0; i < count; i++)
+			free(files[i]);
+		reallocate(&heapAllocator, files, capacity * sizeof(char*), 0);
+		reallocate(&heapAllocator, paths, argc * sizeof(char*), 0);
+		return r;
 	}
 	
+	if(decodeTrace)
+	{
+		OutputBuffer out;
+		initOutputBuffer(&out, stdout, OUTPUT_BUFFER_SIZE);
+		bool decoded = decodeTraceFile(&out, decodeTrace);
+		freeOutputBuffer(&out);
+		return decoded ? RESULT_OK : RESULT_IO_ERROR;
+	}
+
+	if(options.native)
+		return runNative(&options);
+
+	if(options.columns && (options.registers || !fileSet))
+	{
+		fprintf(stderr, "--columns needs an expression file and a stack chunk.\n");
+		exit(RESULT_IO_ERROR);
+	}
+
+	Arena arena;
+	initArena(&arena, ARENA_BLOCK_SIZE);
+	options.arena = &arena;
+
+	Cache optionsCache;
+	if(cache || cacheStats)
+	{
+		if(!initCache(&optionsCache, cacheDirectory, cacheSize))
+			exit(RESULT_IO_ERROR);
+		options.cache = &optionsCache;
+	}
+
+	if(cacheStats)
+	{
+		uint64_t hits, misses;
+		saveCacheStats(options.cache, &hits, &misses);
+		printf("cache: %s | hits: %llu | misses: %llu\n", optionsCache.directory, (unsigned long long)hits, (unsigned long long)misses);
+		if(!fileSet)
+			return 0;
+	}
+
+	if(options.batch)
+	{
+		FILE* in = fileSet ? fopen(file, "rb") : stdin;
+		if(in == NULL)
+		{
+			fprintf(stderr, "could not open file: \"%s\".\n", file);
+			exit(RESULT_IO_ERROR);
+		}
+		Result r = runBatch(in, &options);
+		freeArena(&arena);
+		return r;
+	}
+
 	if(fileSet)
-		runFile(file, bytecode);
+		runFile(file, &options);
 	else
-		printf("Usage: name [filename]\n");
+		repl(&options);
 
+	freeArena(&arena);
+	reallocate(&heapAllocator, paths, argc * sizeof(char*), 0);
 	return 0;
 }
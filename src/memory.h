@@ -0,0 +1,200 @@
+#ifndef MEMORY_H
+#define MEMORY_H
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// allocators used by chunks and the compiler.
+// resize works like realloc, but is also told the old size, and frees when newSize is 0.
+
+typedef struct Allocator Allocator;
+struct Allocator
+{
+	void* (*resize)(Allocator* allocator, void* pointer, size_t oldSize, size_t newSize);
+};
+
+void* reallocate(Allocator* allocator, void* pointer, size_t oldSize, size_t newSize)
+{
+	void* result = allocator->resize(allocator, pointer, oldSize, newSize);
+	if(newSize && !result)
+	{
+		fprintf(stderr, "memory allocation failed!\n");
+		exit(74);
+	}
+	return result;
+}
+
+void* heapResize(Allocator* allocator, void* pointer, size_t oldSize, size_t newSize)
+{
+	(void)allocator;
+	(void)oldSize;
+	if(newSize == 0)
+	{
+		free(pointer);
+		return NULL;
+	}
+	return realloc(pointer, newSize);
+}
+
+// malloc and free, it has no state.
+Allocator heapAllocator = { heapResize };
+
+// bump allocator for everything of one compilation unit.
+// freeing only gives memory back when it is the last allocation, resetArena() frees everything at once
+// and keeps the blocks for the next unit.
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define ARENA_ALIGNMENT 16
+
+typedef struct ArenaBlock
+{
+	struct ArenaBlock* next;
+	size_t capacity;
+	size_t used;
+	uint8_t* data;
+} ArenaBlock;
+
+typedef struct Arena
+{
+	Allocator allocator; // first, so an Allocator* of the arena is also an Arena*.
+	ArenaBlock* first;
+	ArenaBlock* current;
+	uint8_t* last; // the last allocation, the only one that can grow in place.
+
+	size_t used; // bytes allocated since the last reset.
+	size_t peak; // most bytes used between two resets.
+	size_t blockAllocations;
+} Arena;
+
+size_t alignSize(size_t size)
+{
+	return (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+}
+
+ArenaBlock* newArenaBlock(Arena* arena, size_t capacity)
+{
+	ArenaBlock* block = (ArenaBlock*)malloc(sizeof(ArenaBlock) + ARENA_ALIGNMENT + capacity);
+	if(!block)
+		return NULL;
+
+	block->next = NULL;
+	block->capacity = capacity;
+	block->used = 0;
+	block->data = (uint8_t*)alignSize((uintptr_t)(block + 1));
+	arena->blockAllocations++;
+	return block;
+}
+
+void* arenaAllocate(Arena* arena, size_t size)
+{
+	size = alignSize(size);
+
+	// use the next block that fits, blocks that are too small are skipped until the next reset.
+	while(arena->current->capacity - arena->current->used < size)
+	{
+		if(!arena->current->next)
+		{
+			size_t capacity = arena->current->capacity * 2;
+			while(capacity < size)
+				capacity *= 2;
+
+			if(!(arena->current->next = newArenaBlock(arena, capacity)))
+				return NULL;
+		}
+		arena->current = arena->current->next;
+		arena->current->used = 0;
+	}
+
+	uint8_t* pointer = arena->current->data + arena->current->used;
+	arena->current->used += size;
+	arena->used += size;
+	if(arena->used > arena->peak)
+		arena->peak = arena->used;
+	arena->last = pointer;
+	return pointer;
+}
+
+void* arenaResize(Allocator* allocator, void* pointer, size_t oldSize, size_t newSize)
+{
+	Arena* arena = (Arena*)allocator;
+	ArenaBlock* block = arena->current;
+
+	if(pointer && pointer == arena->last)
+	{
+		size_t start = (uint8_t*)pointer - block->data;
+		size_t size = alignSize(newSize);
+		if(start + size <= block->capacity)
+		{
+			arena->used = arena->used - (block->used - start) + size;
+			if(arena->used > arena->peak)
+				arena->peak = arena->used;
+			block->used = start + size;
+			if(newSize == 0)
+				arena->last = NULL;
+			return newSize ? pointer : NULL;
+		}
+	}
+
+	if(newSize == 0)
+		return NULL;
+
+	void* result = arenaAllocate(arena, newSize);
+	if(result && pointer)
+		memcpy(result, pointer, oldSize < newSize ? oldSize : newSize);
+	return result;
+}
+
+// size is how much the first block holds, see reserveArena().
+void initArena(Arena* arena, size_t size)
+{
+	arena->allocator.resize = arenaResize;
+	arena->blockAllocations = 0;
+	arena->used = 0;
+	arena->peak = 0;
+	arena->last = NULL;
+
+	if(!(arena->first = newArenaBlock(arena, size < ARENA_BLOCK_SIZE ? ARENA_BLOCK_SIZE : size)))
+	{
+		fprintf(stderr, "memory allocation failed!\n");
+		exit(74);
+	}
+	arena->current = arena->first;
+}
+
+void resetArena(Arena* arena)
+{
+	arena->current = arena->first;
+	arena->first->used = 0;
+	arena->used = 0;
+	arena->last = NULL;
+}
+
+// makes sure the arena can hold size bytes without allocating, only call it right after a reset.
+void reserveArena(Arena* arena, size_t size)
+{
+	if(arena->first->capacity >= size)
+		return;
+
+	ArenaBlock* block = newArenaBlock(arena, size);
+	if(!block)
+	{
+		fprintf(stderr, "memory allocation failed!\n");
+		exit(74);
+	}
+	block->next = arena->first;
+	arena->first = arena->current = block;
+}
+
+void freeArena(Arena* arena)
+{
+	ArenaBlock* block = arena->first;
+	while(block)
+	{
+		ArenaBlock* next = block->next;
+		free(block);
+		block = next;
+	}
+}
+
+#endif
@@ -0,0 +1,232 @@
+#ifndef NATIVE_H
+#define NATIVE_H
+#include <dlfcn.h>
+#include <limits.h>
+#include <math.h>
+#include <stdbool.h>
+#include "chunk.h"
+#include "common.h"
+
+// ahead of time translation of chunks to c, and loading of the compiled result.
+// the generated file defines double cheeseExpression(const double* inputs), with every stack slot
+// or register a local variable and the constants written as hex floats, and cheeseInputs, the
+// NULL terminated names of the inputs. compile it with:
+//     cc -O2 -shared -fPIC -ffp-contract=off out.c -o out.so
+// -ffp-contract=off keeps a * b + c from becoming one fused operation, which rounds differently
+// than the interpreter.
+
+#define NATIVE_FUNCTION "cheeseExpression"
+#define NATIVE_INPUTS "cheeseInputs"
+
+typedef double (*NativeFunction)(const double* inputs);
+
+typedef struct NativeCode
+{
+	void* library;
+	NativeFunction function;
+	const char* const* inputs;
+	int inputCount;
+} NativeCode;
+
+void writeCValue(FILE* f, Value v)
+{
+	if(isnan(v))
+		fprintf(f, "cheeseBits(0x%016llxull)", (unsigned long long)valueBits(v)); // keeps the sign and payload.
+	else if(isinf(v))
+		fprintf(f, v < 0 ? "-INFINITY" : "INFINITY");
+	else
+		fprintf(f, "%a", v);
+}
+
+void writeCOperand(FILE* f, Chunk* chunk, uint16_t operand)
+{
+	if(operand & RK_CONSTANT)
+		writeCValue(f, chunk->values.data[operand & ~RK_CONSTANT]);
+	else
+		fprintf(f, "r%d", operand);
+}
+
+char cOperator(uint8_t op)
+{
+	switch(op)
+	{
+		case OP_ADD: case OP_ADD_CONSTANT          : return '+';
+		case OP_SUBTRACT: case OP_SUBTRACT_CONSTANT: return '-';
+		case OP_MULTIPLY: case OP_MULTIPLY_CONSTANT: return '*';
+		default                                    : return '/';
+	}
+}
+
+char cRegisterOperator(uint8_t op)
+{
+	switch(op)
+	{
+		case ROP_ADD     : return '+';
+		case ROP_SUBTRACT: return '-';
+		case ROP_MULTIPLY: return '*';
+		default          : return '/';
+	}
+}
+
+void writeStackC(Chunk* chunk, FILE* f)
+{
+	int top = 0;
+	for(size_t i = 0; i < chunk->size; i += opCodeSize(chunk->data[i]))
+	{
+		uint8_t op = chunk->data[i];
+		switch(op)
+		{
+		case OP_RETURN:
+			fprintf(f, "\treturn s%d;\n", --top);
+			break;
+		case OP_CONSTANT:
+		case OP_LONG_CONSTANT:
+			fprintf(f, "\ts%d = ", top++);
+			writeCValue(f, chunk->values.data[op == OP_CONSTANT ? chunk->data[i + 1] : readShort(chunk, i + 1)]);
+			fprintf(f, ";\n");
+			break;
+		case OP_CONSTANT_CONSTANT:
+			for(int j = 1; j <= 2; j++)
+			{
+				fprintf(f, "\ts%d = ", top++);
+				writeCValue(f, chunk->values.data[chunk->data[i + j]]);
+				fprintf(f, ";\n");
+			}
+			break;
+		case OP_INPUT:
+			fprintf(f, "\ts%d = inputs[%d];\n", top++, chunk->data[i + 1]);
+			break;
+		case OP_NEGATE:
+			fprintf(f, "\ts%d = -s%d;\n", top - 1, top - 1);
+			break;
+		case OP_ADD:
+		case OP_SUBTRACT:
+		case OP_MULTIPLY:
+		case OP_DIVIDE:
+			top--;
+			fprintf(f, "\ts%d = s%d %c s%d;\n", top - 1, top - 1, cOperator(op), top);
+			break;
+		default:
+			fprintf(f, "\ts%d = s%d %c ", top - 1, top - 1, cOperator(op));
+			writeCValue(f, chunk->values.data[chunk->data[i + 1]]);
+			fprintf(f, ";\n");
+			break;
+		}
+	}
+}
+
+void writeRegisterC(Chunk* chunk, FILE* f)
+{
+	for(size_t i = 0; i < chunk->size; i += registerOpCodeSize(chunk->data[i]))
+	{
+		uint8_t op = chunk->data[i];
+		switch(op)
+		{
+		case ROP_RETURN:
+			fprintf(f, "\treturn ");
+			writeCOperand(f, chunk, readShort(chunk, i + 1));
+			fprintf(f, ";\n");
+			break;
+		case ROP_LOAD:
+			fprintf(f, "\tr%d = ", chunk->data[i + 1]);
+			writeCOperand(f, chunk, readShort(chunk, i + 2) | RK_CONSTANT);
+			fprintf(f, ";\n");
+			break;
+		case ROP_NEGATE:
+			fprintf(f, "\tr%d = -", chunk->data[i + 1]);
+			writeCOperand(f, chunk, readShort(chunk, i + 2));
+			fprintf(f, ";\n");
+			break;
+		default:
+			fprintf(f, "\tr%d = ", chunk->data[i + 1]);
+			writeCOperand(f, chunk, readShort(chunk, i + 2));
+			fprintf(f, " %c ", cRegisterOperator(op));
+			writeCOperand(f, chunk, readShort(chunk, i + 4));
+			fprintf(f, ";\n");
+			break;
+		}
+	}
+}
+
+// writes chunk as a c file, inputs are the names of its inputs.
+bool writeCFile(Chunk* chunk, const char* const* inputs, int inputCount, const char* path)
+{
+	FILE* f = fopen(path, "w");
+	if(f == NULL)
+	{
+		fprintf(stderr, "could not open file: \"%s\".\n", path);
+		return false;
+	}
+
+	fprintf(f, "// generated by cheeseScript %s, build with: cc -O2 -shared -fPIC -ffp-contract=off\n", COMPILER_VERSION);
+	fprintf(f, "#include <math.h>\n#include <stddef.h>\n#include <stdint.h>\n#include <string.h>\n\n");
+	fprintf(f, "static inline double cheeseBits(uint64_t bits)\n{\n\tdouble v;\n\tmemcpy(&v, &bits, sizeof(v));\n\treturn v;\n}\n\n");
+
+	fprintf(f, "const char* " NATIVE_INPUTS "[] = { ");
+	for(int i = 0; i < inputCount; i++)
+	{
+		fputc('"', f);
+		for(const char* c = inputs[i]; *c; c++)
+			fprintf(f, *c == '"' || *c == '\\' ? "\\%c" : "%c", *c);
+		fprintf(f, "\", ");
+	}
+	fprintf(f, "NULL };\n\n");
+
+	fprintf(f, "double " NATIVE_FUNCTION "(const double* inputs)\n{\n");
+	char prefix = chunk->type == CHUNK_REGISTER ? 'r' : 's';
+	for(size_t i = 0; i < chunk->maxStack; i++)
+		fprintf(f, "\tdouble %c%zu;\n", prefix, i);
+	fprintf(f, "\t(void)inputs;\n\n");
+
+	if(chunk->type == CHUNK_REGISTER)
+		writeRegisterC(chunk, f);
+	else
+		writeStackC(chunk, f);
+	fprintf(f, "}\n");
+
+	bool failed = ferror(f);
+	if(fclose(f) || failed)
+	{
+		fprintf(stderr, "could not write file: \"%s\".\n", path);
+		return false;
+	}
+	return true;
+}
+
+void freeNative(NativeCode* native)
+{
+	if(native->library)
+		dlclose(native->library);
+	native->library = NULL;
+}
+
+// loads a shared object compiled from the output of writeCFile().
+bool loadNative(NativeCode* native, const char* path)
+{
+	native->library = NULL;
+
+	// without a slash dlopen() searches the library path instead of the working directory.
+	char local[PATH_MAX];
+	if(!strchr(path, '/') && snprintf(local, sizeof(local), "./%s", path) < (int)sizeof(local))
+		path = local;
+
+	if(!(native->library = dlopen(path, RTLD_NOW | RTLD_LOCAL)))
+	{
+		fprintf(stderr, "could not load library: %s.\n", dlerror());
+		return false;
+	}
+
+	native->function = (NativeFunction)dlsym(native->library, NATIVE_FUNCTION);
+	native->inputs = (const char* const*)dlsym(native->library, NATIVE_INPUTS);
+	if(!native->function || !native->inputs)
+	{
+		fprintf(stderr, "not a compiled expression: \"%s\".\n", path);
+		freeNative(native);
+		return false;
+	}
+
+	for(native->inputCount = 0; native->inputs[native->inputCount]; native->inputCount++);
+	return true;
+}
+
+#endif
@@ -0,0 +1,237 @@
+#ifndef NUMBER_H
+#define NUMBER_H
+#include <float.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// number literals: digits, an optional fraction and an optional exponent (1.5e-3).
+// literals with at most 19 significant digits whose value and power of ten are exact doubles are
+// converted with one multiplication or division, which ieee rounds correctly (clinger's fast path).
+// everything else goes to strtod, which is correctly rounded too. the interpreter never changes
+// the locale, so strtod always uses '.'.
+
+static const double exactPowersOfTen[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+#define MAX_EXACT_INTEGER (1ULL << 53)
+
+double parseNumberSlow(const char* start, size_t length)
+{
+	char buffer[64];
+	char* text = length < sizeof(buffer) ? buffer : (char*)malloc(length + 1);
+	if(!text)
+	{
+		fprintf(stderr, "memory allocation failed!\n");
+		exit(74);
+	}
+
+	memcpy(text, start, length);
+	text[length] = '\0';
+	double value = strtod(text, NULL);
+
+	if(text != buffer)
+		free(text);
+	return value;
+}
+
+double parseNumber(const char* start, size_t length)
+{
+	const char* p = start;
+	const char* end = start + length;
+	uint64_t mantissa = 0;
+	int digits = 0; // significant digits in mantissa.
+	int exponent = 0;
+	bool exact = true;
+
+	for(; p < end && *p >= '0' && *p <= '9'; p++)
+	{
+		if(digits < 19)
+		{
+			mantissa = mantissa * 10 + (*p - '0');
+			digits += mantissa != 0;
+		}
+		else
+		{
+			exact = false;
+			exponent++;
+		}
+	}
+
+	if(p < end && *p == '.')
+	{
+		for(p++; p < end && *p >= '0' && *p <= '9'; p++)
+		{
+			if(digits < 19)
+			{
+				mantissa = mantissa * 10 + (*p - '0');
+				digits += mantissa != 0;
+				exponent--;
+			}
+			else
+				exact = false;
+		}
+	}
+
+	if(p < end && (*p == 'e' || *p == 'E'))
+	{
+		p++;
+		bool negative = p < end && *p == '-';
+		if(p < end && (*p == '-' || *p == '+'))
+			p++;
+
+		int value = 0;
+		for(; p < end && *p >= '0' && *p <= '9'; p++)
+			if(value < 100000)
+				value = value * 10 + (*p - '0');
+		exponent += negative ? -value : value;
+	}
+
+	if(mantissa == 0 && exact)
+		return 0.0;
+
+#if FLT_EVAL_METHOD == 0
+	if(exact && mantissa <= MAX_EXACT_INTEGER)
+	{
+		double value = (double)mantissa;
+		if(exponent >= 0 && exponent <= 22)
+			return value * exactPowersOfTen[exponent];
+		if(exponent < 0 && exponent >= -22)
+			return value / exactPowersOfTen[-exponent];
+
+		// 123e30 is 123000000000000e15 * 1e15, fine as long as the first factor is still exact.
+		if(exponent > 22 && exponent <= 22 + 15)
+		{
+			uint64_t scaled = mantissa;
+			for(int i = 0; i < exponent - 22 && scaled <= MAX_EXACT_INTEGER; i++)
+				scaled *= 10;
+			if(scaled <= MAX_EXACT_INTEGER)
+				return (double)scaled * exactPowersOfTen[22];
+		}
+	}
+#endif
+
+	return parseNumberSlow(start, length);
+}
+
+// length of the number literal at the start of text, 0 if there is none. same syntax as scanNumber().
+size_t numberLength(const char* text, size_t length)
+{
+	const char* p = text;
+	const char* end = text + length;
+	while(p < end && *p >= '0' && *p <= '9')
+		p++;
+	if(p == text)
+		return 0;
+
+	if(p + 1 < end && *p == '.' && p[1] >= '0' && p[1] <= '9')
+		for(p++; p < end && *p >= '0' && *p <= '9'; p++);
+
+	if(p < end && (*p == 'e' || *p == 'E'))
+	{
+		const char* digits = p + 1;
+		if(digits < end && (*digits == '+' || *digits == '-'))
+			digits++;
+		if(digits < end && *digits >= '0' && *digits <= '9')
+			for(p = digits; p < end && *p >= '0' && *p <= '9'; p++);
+	}
+	return p - text;
+}
+
+#define NUMBER_FORMAT_MAX 32
+
+int writeDigits(char* buffer, uint64_t n)
+{
+	char digits[20];
+	int count = 0;
+	int length = 0;
+
+	do
+	{
+		digits[count++] = '0' + n % 10;
+		n /= 10;
+	} while(n);
+
+	while(count)
+		buffer[length++] = digits[--count];
+	return length;
+}
+
+// writes the shortest text that parses back to exactly v, laid out like %.15g (0.1, 1e+20, -0, inf).
+// v is written as m / 10^k for the smallest k where that division gives v back, as long as m stays
+// far below 2^53 so both are exact and ieee rounds the division like strtod does. that covers
+// integers and anything with up to 15 significant digits above 1e-4. for the rest the 15 digit
+// rounding is tried first, which is the shortest form whenever one of at most 15 digits exists
+// (subnormals start lower), then 16 and 17 digits, 17 always round trips.
+// returns the length, buffer needs NUMBER_FORMAT_MAX bytes.
+int formatNumber(char* buffer, double v)
+{
+	if(!isfinite(v))
+		return snprintf(buffer, NUMBER_FORMAT_MAX, "%g", v);
+
+	int length = 0;
+	if(signbit(v))
+	{
+		buffer[length++] = '-';
+		v = -v;
+	}
+
+	if(v < 1e15 && v == (double)(uint64_t)v)
+	{
+		length += writeDigits(buffer + length, (uint64_t)v);
+		buffer[length] = '\0';
+		return length;
+	}
+
+	// the loop below already found everything with at most 15 digits in this range.
+	int precision = 15;
+	if(v >= 1e-4 && v < 1e15)
+	{
+		precision = 16;
+		for(int k = 1; k <= 19; k++)
+		{
+			double scaled = v * exactPowersOfTen[k];
+			if(scaled >= (double)(1ULL << 50))
+				break;
+
+			uint64_t m = (uint64_t)(scaled + 0.5);
+			if((double)m / exactPowersOfTen[k] != v)
+				continue;
+
+			uint64_t integer = m / (uint64_t)exactPowersOfTen[k];
+			uint64_t fraction = m % (uint64_t)exactPowersOfTen[k];
+			length += writeDigits(buffer + length, integer);
+			buffer[length++] = '.';
+
+			char digits[20];
+			int count = writeDigits(digits, fraction);
+			for(int i = count; i < k; i++)
+				buffer[length++] = '0';
+			while(digits[count - 1] == '0')
+				count--;
+			memcpy(buffer + length, digits, count);
+			length += count;
+			buffer[length] = '\0';
+			return length;
+		}
+	}
+
+	// subnormals have fewer digits of precision, 15 digits can be too many.
+	if(v < DBL_MIN)
+		precision = 1;
+
+	for(; precision <= 17; precision++)
+	{
+		int written = snprintf(buffer + length, NUMBER_FORMAT_MAX - length, "%.*g", precision, v);
+		if(precision == 17 || parseNumber(buffer + length, written) == v)
+			return length + written;
+	}
+	return length;
+}
+
+#endif
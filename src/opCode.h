@@ -1,5 +1,6 @@
 #ifndef OPCODE_H
 #define OPCODE_H
+#include <stdint.h>
 
 enum opCode
 {
@@ -10,7 +11,102 @@ enum opCode
 	OP_ADD,
 	OP_SUBTRACT,
 	OP_MULTIPLY,
-	OP_DIVIDE
+	OP_DIVIDE,
+	// superinstructions, made by the optimizer. the operand is a one byte constant index.
+	OP_ADD_CONSTANT,
+	OP_SUBTRACT_CONSTANT,
+	OP_MULTIPLY_CONSTANT,
+	OP_DIVIDE_CONSTANT,
+	OP_CONSTANT_CONSTANT, // two one byte constant indices.
+	OP_INPUT, // one byte index of a named input, see columns.h.
+	OP_COUNT
 };
 
-#endif
\ No newline at end of file
+// size in bytes of a stack instruction, including its operands.
+int opCodeSize(uint8_t op)
+{
+	switch(op)
+	{
+		case OP_CONSTANT         : return 2;
+		case OP_LONG_CONSTANT    : return 3;
+		case OP_ADD_CONSTANT     : return 2;
+		case OP_SUBTRACT_CONSTANT: return 2;
+		case OP_MULTIPLY_CONSTANT: return 2;
+		case OP_DIVIDE_CONSTANT  : return 2;
+		case OP_CONSTANT_CONSTANT: return 3;
+		case OP_INPUT            : return 2;
+		default                  : return 1;
+	}
+}
+
+// values a stack instruction pushes minus the values it pops.
+int opCodeStackEffect(uint8_t op)
+{
+	switch(op)
+	{
+		case OP_RETURN           : return -1;
+		case OP_CONSTANT         : return 1;
+		case OP_LONG_CONSTANT    : return 1;
+		case OP_ADD              : return -1;
+		case OP_SUBTRACT         : return -1;
+		case OP_MULTIPLY         : return -1;
+		case OP_DIVIDE           : return -1;
+		case OP_CONSTANT_CONSTANT: return 2;
+		case OP_INPUT            : return 1;
+		default                  : return 0;
+	}
+}
+
+const char* opCodeName(uint8_t op)
+{
+	switch(op)
+	{
+		case OP_RETURN           : return "RETURN";
+		case OP_CONSTANT         : return "CONSTANT";
+		case OP_LONG_CONSTANT    : return "LONG_CONSTANT";
+		case OP_NEGATE           : return "NEGATE";
+		case OP_ADD              : return "ADD";
+		case OP_SUBTRACT         : return "SUBTRACT";
+		case OP_MULTIPLY         : return "MULTIPLY";
+		case OP_DIVIDE           : return "DIVIDE";
+		case OP_ADD_CONSTANT     : return "ADD_CONSTANT";
+		case OP_SUBTRACT_CONSTANT: return "SUBTRACT_CONSTANT";
+		case OP_MULTIPLY_CONSTANT: return "MULTIPLY_CONSTANT";
+		case OP_DIVIDE_CONSTANT  : return "DIVIDE_CONSTANT";
+		case OP_CONSTANT_CONSTANT: return "CONSTANT_CONSTANT";
+		case OP_INPUT            : return "INPUT";
+		default                  : return "UNKNOWN";
+	}
+}
+
+// three-address instructions of register chunks.
+// destinations are one byte register numbers, sources are two byte (little endian)
+// operands that name a register, or a constant when RK_CONSTANT is set.
+enum registerOpCode
+{
+	ROP_RETURN,   // source
+	ROP_LOAD,     // destination, two byte constant index
+	ROP_NEGATE,   // destination, source
+	ROP_ADD,      // destination, source, source
+	ROP_SUBTRACT, // destination, source, source
+	ROP_MULTIPLY, // destination, source, source
+	ROP_DIVIDE    // destination, source, source
+};
+
+// size in bytes of a register instruction, including its operands.
+int registerOpCodeSize(uint8_t op)
+{
+	switch(op)
+	{
+		case ROP_RETURN: return 3;
+		case ROP_LOAD  : return 4;
+		case ROP_NEGATE: return 4;
+		default        : return 6;
+	}
+}
+
+#define RK_CONSTANT 0x8000
+#define REGISTER_MAX 256
+#define INPUT_MAX 256
+
+#endif
@@ -0,0 +1,211 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+#include "chunk.h"
+
+// peephole optimizer for stack chunks.
+// the chunk is decoded, every instruction is appended to the output and the end of the output is
+// rewritten as long as a pattern matches. the result is encoded again into new code and line info.
+// negated constants are folded in a second pass, so -(-x) and a - (-x) are simplified first,
+// and a last pass fuses constants with the instruction after them into superinstructions.
+
+typedef struct Instruction
+{
+	uint8_t op;
+	uint32_t operand; // constant index of OP_CONSTANT, OP_LONG_CONSTANT and the superinstructions.
+	uint32_t operand2; // second constant index of OP_CONSTANT_CONSTANT.
+	uint32_t line;
+} Instruction;
+
+typedef enum PeepholePass
+{
+	PASS_SIMPLIFY,
+	PASS_CONSTANTS,
+	PASS_FUSE,
+} PeepholePass;
+
+typedef struct OptimizerStats
+{
+	size_t bytesRemoved;
+	size_t instructionsRemoved;
+} OptimizerStats;
+
+bool isConstantOp(uint8_t op)
+{
+	return op == OP_CONSTANT || op == OP_LONG_CONSTANT;
+}
+
+// the superinstruction for a binary operator with a constant right operand, or 0.
+uint8_t constantOperator(uint8_t op)
+{
+	switch(op)
+	{
+		case OP_ADD     : return OP_ADD_CONSTANT;
+		case OP_SUBTRACT: return OP_SUBTRACT_CONSTANT;
+		case OP_MULTIPLY: return OP_MULTIPLY_CONSTANT;
+		case OP_DIVIDE  : return OP_DIVIDE_CONSTANT;
+		default         : return 0;
+	}
+}
+
+bool fuseTail(Instruction* code, size_t* size)
+{
+	Instruction* a = &code[*size - 2];
+	Instruction* b = &code[*size - 1];
+
+	// constant; add -> add_constant
+	if(a->op == OP_CONSTANT && constantOperator(b->op))
+	{
+		a->op = constantOperator(b->op);
+		a->line = b->line;
+		(*size)--;
+		return true;
+	}
+
+	// constant; constant -> constant_constant
+	if(a->op == OP_CONSTANT && b->op == OP_CONSTANT)
+	{
+		a->op = OP_CONSTANT_CONSTANT;
+		a->operand2 = b->operand;
+		(*size)--;
+		return true;
+	}
+
+	// constant_constant; add -> constant; add_constant
+	if(a->op == OP_CONSTANT_CONSTANT && constantOperator(b->op))
+	{
+		a->op = OP_CONSTANT;
+		b->op = constantOperator(b->op);
+		b->operand = a->operand2;
+		return true;
+	}
+
+	return false;
+}
+
+// rewrites the last instructions of code, returns false if no pattern matched.
+bool rewriteTail(Chunk* chunk, Instruction* code, size_t* size, PeepholePass pass)
+{
+	if(*size < 2)
+		return false;
+
+	if(pass == PASS_FUSE)
+		return fuseTail(code, size);
+
+	Instruction* a = &code[*size - 2];
+	Instruction* b = &code[*size - 1];
+
+	if(b->op != OP_NEGATE)
+	{
+		// a - (-b) -> a + b, a + (-b) -> a - b
+		if(a->op == OP_NEGATE && (b->op == OP_SUBTRACT || b->op == OP_ADD))
+		{
+			a->op = b->op == OP_SUBTRACT ? OP_ADD : OP_SUBTRACT;
+			a->line = b->line;
+			(*size)--;
+			return true;
+		}
+		return false;
+	}
+
+	// -(-x) -> x
+	if(a->op == OP_NEGATE)
+	{
+		*size -= 2;
+		return true;
+	}
+
+	// -constant -> constant, unless the instruction would grow.
+	if(pass == PASS_CONSTANTS && isConstantOp(a->op))
+	{
+		size_t poolSize = chunk->values.size;
+		uint32_t constant = internValue(&chunk->values, -chunk->values.data[a->operand]);
+		if(constant > (a->op == OP_CONSTANT ? 0xff : 0xffff))
+		{
+			if(chunk->values.size > poolSize)
+				removeLastValue(&chunk->values);
+			return false;
+		}
+
+		a->op = constant <= 0xff ? OP_CONSTANT : OP_LONG_CONSTANT;
+		a->operand = constant;
+		(*size)--;
+		return true;
+	}
+
+	return false;
+}
+
+// rewrites code in place, returns the new amount of instructions.
+size_t peephole(Chunk* chunk, Instruction* code, size_t count, PeepholePass pass)
+{
+	size_t size = 0;
+	for(size_t i = 0; i < count; i++)
+	{
+		code[size++] = code[i];
+		while(rewriteTail(chunk, code, &size, pass));
+	}
+	return size;
+}
+
+OptimizerStats optimizeChunk(Chunk* chunk)
+{
+	OptimizerStats stats = { 0, 0 };
+	if(chunk->type != CHUNK_STACK || chunk->size == 0)
+		return stats;
+
+	Instruction* code = (Instruction*)malloc(chunk->size * sizeof(Instruction));
+	if(!code)
+	{
+		fprintf(stderr, "memory allocation failed!\n");
+		exit(74);
+	}
+
+	size_t decoded = 0;
+	for(size_t offset = 0; offset < chunk->size; offset += opCodeSize(chunk->data[offset]))
+	{
+		Instruction* instruction = &code[decoded++];
+		instruction->op = chunk->data[offset];
+		instruction->line = getLine(&chunk->lines, offset);
+		if(instruction->op == OP_LONG_CONSTANT)
+			instruction->operand = readShort(chunk, offset + 1);
+		else if(opCodeSize(instruction->op) > 1)
+			instruction->operand = chunk->data[offset + 1];
+		if(instruction->op == OP_CONSTANT_CONSTANT)
+			instruction->operand2 = chunk->data[offset + 2];
+	}
+
+	size_t size = peephole(chunk, code, decoded, PASS_SIMPLIFY);
+	size = peephole(chunk, code, size, PASS_CONSTANTS);
+	size = peephole(chunk, code, size, PASS_FUSE);
+
+	Chunk optimized;
+	initChunkWithAllocator(&optimized, chunk->allocator);
+	for(size_t i = 0; i < size; i++)
+	{
+		if(isConstantOp(code[i].op))
+			addConstantInstrution(&optimized, code[i].operand, code[i].line);
+		else
+		{
+			addToChunk(&optimized, code[i].op, code[i].line);
+			if(opCodeSize(code[i].op) > 1)
+				addToChunk(&optimized, (uint8_t)code[i].operand, code[i].line);
+			if(code[i].op == OP_CONSTANT_CONSTANT)
+				addToChunk(&optimized, (uint8_t)code[i].operand2, code[i].line);
+		}
+	}
+	free(code);
+
+	stats.bytesRemoved = chunk->size - optimized.size;
+	stats.instructionsRemoved = decoded - size;
+
+	reallocate(chunk->allocator, chunk->data, chunk->capacity, 0);
+	freeLineInfo(&chunk->lines);
+	chunk->data = optimized.data;
+	chunk->size = optimized.size;
+	chunk->capacity = optimized.capacity;
+	chunk->lines = optimized.lines;
+	chunk->maxStack = measureStack(chunk);
+	return stats;
+}
+
+#endif
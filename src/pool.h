@@ -0,0 +1,123 @@
+#ifndef POOL_H
+#define POOL_H
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "memory.h"
+
+// runs a fixed set of jobs on worker threads. every worker has its own queue of job numbers, it takes
+// jobs from the back of its own queue and, when that is empty, steals from the front of the others,
+// so a worker that got a few big jobs does not leave the rest idle.
+// jobs do not add jobs, so a worker is done when it finds every queue empty.
+
+typedef void (*JobFunction)(void* context, size_t job, int worker);
+
+typedef struct WorkQueue
+{
+	pthread_mutex_t lock;
+	size_t* jobs;
+	size_t front;
+	size_t back; // one past the last job.
+} WorkQueue;
+
+typedef struct ThreadPool
+{
+	WorkQueue* queues;
+	int workers;
+	JobFunction function;
+	void* context;
+} ThreadPool;
+
+typedef struct Worker
+{
+	ThreadPool* pool;
+	int index;
+} Worker;
+
+bool takeJob(WorkQueue* queue, size_t* job, bool steal)
+{
+	pthread_mutex_lock(&queue->lock);
+	bool found = queue->front < queue->back;
+	if(found)
+		*job = steal ? queue->jobs[queue->front++] : queue->jobs[--queue->back];
+	pthread_mutex_unlock(&queue->lock);
+	return found;
+}
+
+void* runWorker(void* argument)
+{
+	Worker* worker = (Worker*)argument;
+	ThreadPool* pool = worker->pool;
+	size_t job;
+
+	while(true)
+	{
+		bool found = takeJob(&pool->queues[worker->index], &job, false);
+		for(int i = 1; !found && i < pool->workers; i++)
+			found = takeJob(&pool->queues[(worker->index + i) % pool->workers], &job, true);
+
+		if(!found)
+			return NULL;
+		pool->function(pool->context, job, worker->index);
+	}
+}
+
+// calls function(context, job, worker) for every job below count, with worker below workers.
+// returns when all jobs are done.
+void runJobs(size_t count, int workers, JobFunction function, void* context)
+{
+	if(workers < 1)
+		workers = 1;
+	if((size_t)workers > count)
+		workers = count ? (int)count : 1;
+
+	ThreadPool pool;
+	pool.workers = workers;
+	pool.function = function;
+	pool.context = context;
+	pool.queues = (WorkQueue*)reallocate(&heapAllocator, NULL, 0, workers * sizeof(WorkQueue));
+	Worker* threads = (Worker*)reallocate(&heapAllocator, NULL, 0, workers * sizeof(Worker));
+	pthread_t* ids = (pthread_t*)reallocate(&heapAllocator, NULL, 0, workers * sizeof(pthread_t));
+
+	// deal the jobs out in turns, back to front: a worker does its own jobs in input order,
+	// and jobs are stolen from the end of the input.
+	for(int i = 0; i < workers; i++)
+	{
+		WorkQueue* queue = &pool.queues[i];
+		pthread_mutex_init(&queue->lock, NULL);
+		queue->jobs = (size_t*)reallocate(&heapAllocator, NULL, 0, (count / workers + 1) * sizeof(size_t));
+		queue->front = queue->back = 0;
+	}
+	for(size_t job = count; job-- > 0;)
+	{
+		WorkQueue* queue = &pool.queues[job % workers];
+		queue->jobs[queue->back++] = job;
+	}
+
+	// the calling thread is worker 0.
+	for(int i = 0; i < workers; i++)
+	{
+		threads[i].pool = &pool;
+		threads[i].index = i;
+		if(i && pthread_create(&ids[i], NULL, runWorker, &threads[i]))
+		{
+			fprintf(stderr, "could not start thread!\n");
+			exit(74);
+		}
+	}
+	runWorker(&threads[0]);
+	for(int i = 1; i < workers; i++)
+		pthread_join(ids[i], NULL);
+
+	for(int i = 0; i < workers; i++)
+	{
+		pthread_mutex_destroy(&pool.queues[i].lock);
+		reallocate(&heapAllocator, pool.queues[i].jobs, (count / workers + 1) * sizeof(size_t), 0);
+	}
+	reallocate(&heapAllocator, pool.queues, workers * sizeof(WorkQueue), 0);
+	reallocate(&heapAllocator, threads, workers * sizeof(Worker), 0);
+	reallocate(&heapAllocator, ids, workers * sizeof(pthread_t), 0);
+}
+
+#endif
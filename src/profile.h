@@ -0,0 +1,193 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include "chunk.h"
+
+// time spent per opcode and per source line, collected by runProfiled() in vm.h.
+// every instruction is charged the time from its start to the start of the next one.
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define PROFILE_UNIT "cycles"
+uint64_t readClock()
+{
+	return __rdtsc();
+}
+#else
+#define PROFILE_UNIT "ns"
+uint64_t readClock()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+#endif
+
+typedef struct Profile
+{
+	uint64_t counts[OP_COUNT];
+	uint64_t time[OP_COUNT];
+
+	// indexed by line run of chunk, not by line number: the runs are bounded by the code size,
+	// the line numbers of a bytecode file are not.
+	uint64_t* lineCounts;
+	uint64_t* lineTime;
+	size_t lineCapacity;
+
+	Chunk* chunk;
+	uint8_t* previous; // the instruction that is running, NULL before the first one.
+	uint64_t start;
+} Profile;
+
+void initProfile(Profile* profile)
+{
+	memset(profile->counts, 0, sizeof(profile->counts));
+	memset(profile->time, 0, sizeof(profile->time));
+	profile->lineCounts = NULL;
+	profile->lineTime = NULL;
+	profile->lineCapacity = 0;
+	profile->chunk = NULL;
+	profile->previous = NULL;
+}
+
+void freeProfile(Profile* profile)
+{
+	reallocate(&heapAllocator, profile->lineCounts, profile->lineCapacity * sizeof(uint64_t), 0);
+	reallocate(&heapAllocator, profile->lineTime, profile->lineCapacity * sizeof(uint64_t), 0);
+	initProfile(profile);
+}
+
+// makes room for the lines of chunk, which is about to run.
+void startProfile(Profile* profile, Chunk* chunk)
+{
+	size_t lines = chunk->lines.size ? chunk->lines.size : 1;
+
+	if(lines > profile->lineCapacity)
+	{
+		profile->lineCounts = (uint64_t*)reallocate(&heapAllocator, profile->lineCounts, profile->lineCapacity * sizeof(uint64_t), lines * sizeof(uint64_t));
+		profile->lineTime = (uint64_t*)reallocate(&heapAllocator, profile->lineTime, profile->lineCapacity * sizeof(uint64_t), lines * sizeof(uint64_t));
+		memset(profile->lineCounts + profile->lineCapacity, 0, (lines - profile->lineCapacity) * sizeof(uint64_t));
+		memset(profile->lineTime + profile->lineCapacity, 0, (lines - profile->lineCapacity) * sizeof(uint64_t));
+		profile->lineCapacity = lines;
+	}
+	profile->chunk = chunk;
+	profile->previous = NULL;
+}
+
+// charges the instruction that ran until now, next is the one that starts (NULL at the end).
+void profileInstruction(Profile* profile, uint8_t* next)
+{
+	uint64_t now = readClock();
+	if(profile->previous)
+	{
+		uint64_t spent = now - profile->start;
+		uint8_t op = *profile->previous;
+		size_t run = getLineRun(&profile->chunk->lines, (uint32_t)(profile->previous - profile->chunk->data));
+
+		if(op < OP_COUNT)
+		{
+			profile->counts[op]++;
+			profile->time[op] += spent;
+		}
+		profile->lineCounts[run]++;
+		profile->lineTime[run] += spent;
+	}
+
+	profile->previous = next;
+	// read again, so the bookkeeping above is not charged to the next instruction.
+	profile->start = readClock();
+}
+
+typedef struct ProfileEntry
+{
+	uint32_t key; // opcode or line.
+	uint64_t count;
+	uint64_t time;
+} ProfileEntry;
+
+int compareProfileEntries(const void* a, const void* b)
+{
+	uint64_t x = ((const ProfileEntry*)a)->time;
+	uint64_t y = ((const ProfileEntry*)b)->time;
+	return (x < y) - (x > y);
+}
+
+int compareProfileKeys(const void* a, const void* b)
+{
+	uint32_t x = ((const ProfileEntry*)a)->key;
+	uint32_t y = ((const ProfileEntry*)b)->key;
+	return (x > y) - (x < y);
+}
+
+// writes the opcodes and lines sorted by the time spent in them, lines that never ran are left out.
+void writeProfile(OutputBuffer* out, Profile* profile)
+{
+	uint64_t total = 0;
+	uint64_t instructions = 0;
+	for(int op = 0; op < OP_COUNT; op++)
+	{
+		total += profile->time[op];
+		instructions += profile->counts[op];
+	}
+	double percent = total ? 100.0 / total : 0;
+
+	writeFormat(out, "==== profile: %llu instructions, %llu %s ====\n", (unsigned long long)instructions, (unsigned long long)total, PROFILE_UNIT);
+	writeFormat(out, "%-20s %12s %14s %10s %7s\n", "opcode", "count", PROFILE_UNIT, "per op", "%");
+
+	ProfileEntry ops[OP_COUNT];
+	for(int op = 0; op < OP_COUNT; op++)
+	{
+		ops[op].key = op;
+		ops[op].time = profile->time[op];
+		ops[op].count = profile->counts[op];
+	}
+	qsort(ops, OP_COUNT, sizeof(ProfileEntry), compareProfileEntries);
+	for(int i = 0; i < OP_COUNT; i++)
+	{
+		uint32_t op = ops[i].key;
+		if(profile->counts[op])
+			writeFormat(out, "%-20s %12llu %14llu %10.1f %6.1f%%\n", opCodeName(op), (unsigned long long)profile->counts[op],
+				(unsigned long long)profile->time[op], (double)profile->time[op] / profile->counts[op], profile->time[op] * percent);
+	}
+
+	// a line can have several runs, they are added up after sorting by line.
+	size_t lineCount = 0;
+	ProfileEntry* lines = (ProfileEntry*)reallocate(&heapAllocator, NULL, 0, (profile->lineCapacity + 1) * sizeof(ProfileEntry));
+	for(size_t run = 0; run < profile->lineCapacity; run++)
+	{
+		if(profile->lineCounts[run])
+		{
+			lines[lineCount].key = profile->chunk->lines.lines[run];
+			lines[lineCount].count = profile->lineCounts[run];
+			lines[lineCount++].time = profile->lineTime[run];
+		}
+	}
+	qsort(lines, lineCount, sizeof(ProfileEntry), compareProfileKeys);
+	size_t merged = 0;
+	for(size_t i = 0; i < lineCount; i++)
+	{
+		if(merged && lines[merged - 1].key == lines[i].key)
+		{
+			lines[merged - 1].count += lines[i].count;
+			lines[merged - 1].time += lines[i].time;
+		}
+		else
+			lines[merged++] = lines[i];
+	}
+	lineCount = merged;
+	qsort(lines, lineCount, sizeof(ProfileEntry), compareProfileEntries);
+
+	writeFormat(out, "%-20s %12s %14s %10s %7s\n", "line", "count", PROFILE_UNIT, "per op", "%");
+	for(size_t i = 0; i < lineCount; i++)
+	{
+		ProfileEntry* line = &lines[i];
+		writeFormat(out, "%-20u %12llu %14llu %10.1f %6.1f%%\n", line->key, (unsigned long long)line->count,
+			(unsigned long long)line->time, (double)line->time / line->count, line->time * percent);
+	}
+	reallocate(&heapAllocator, lines, (profile->lineCapacity + 1) * sizeof(ProfileEntry), 0);
+	writeString(out, "================================\n");
+}
+
+#endif
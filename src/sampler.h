@@ -0,0 +1,158 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "chunk.h"
+
+// sampling profiler. runSampled() in vm.h stores the ip of every instruction in sampledInstruction,
+// and a SIGPROF timer records where it points every SAMPLE_INTERVAL microseconds of cpu time.
+// the samples are written as folded stacks (main;line n;OPCODE count), which flame graph tools read.
+
+#define SAMPLE_INTERVAL 1000
+#define SAMPLE_MAX (1 << 20) // about 17 minutes of cpu time.
+
+typedef struct Sampler
+{
+	Chunk* chunk;
+	uint32_t* offsets; // code offset of every sample, allocated up front so the handler does not allocate.
+	size_t count;
+	uint64_t missed; // samples taken outside the code, or after offsets was full.
+	struct sigaction previous;
+} Sampler;
+
+// only touched by the signal handler and the run loop, one sampler runs at a time.
+Sampler* volatile activeSampler = NULL;
+uint8_t* volatile sampledInstruction = NULL;
+
+void sampleSignal(int signal)
+{
+	(void)signal;
+	Sampler* sampler = activeSampler;
+	uint8_t* ip = sampledInstruction;
+	if(!sampler)
+		return;
+
+	if(ip && ip >= sampler->chunk->data && ip < sampler->chunk->data + sampler->chunk->size && sampler->count < SAMPLE_MAX)
+		sampler->offsets[sampler->count++] = (uint32_t)(ip - sampler->chunk->data);
+	else
+		sampler->missed++;
+}
+
+void initSampler(Sampler* sampler)
+{
+	sampler->chunk = NULL;
+	sampler->offsets = NULL;
+	sampler->count = 0;
+	sampler->missed = 0;
+}
+
+void freeSampler(Sampler* sampler)
+{
+	reallocate(&heapAllocator, sampler->offsets, sampler->offsets ? SAMPLE_MAX * sizeof(uint32_t) : 0, 0);
+	initSampler(sampler);
+}
+
+// starts the timer, the samples go to sampler until stopSampler().
+bool startSampler(Sampler* sampler, Chunk* chunk)
+{
+	if(!sampler->offsets)
+		sampler->offsets = (uint32_t*)reallocate(&heapAllocator, NULL, 0, SAMPLE_MAX * sizeof(uint32_t));
+	sampler->chunk = chunk;
+	sampler->count = 0;
+	sampler->missed = 0;
+	sampledInstruction = NULL;
+	activeSampler = sampler;
+
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = sampleSignal;
+	action.sa_flags = SA_RESTART;
+	sigemptyset(&action.sa_mask);
+
+	struct itimerval timer;
+	timer.it_interval.tv_sec = 0;
+	timer.it_interval.tv_usec = SAMPLE_INTERVAL;
+	timer.it_value = timer.it_interval;
+	if(sigaction(SIGPROF, &action, &sampler->previous) || setitimer(ITIMER_PROF, &timer, NULL))
+	{
+		fprintf(stderr, "could not start the sampling timer.\n");
+		activeSampler = NULL;
+		return false;
+	}
+	return true;
+}
+
+void stopSampler(Sampler* sampler)
+{
+	struct itimerval timer;
+	memset(&timer, 0, sizeof(timer));
+	setitimer(ITIMER_PROF, &timer, NULL);
+	sigaction(SIGPROF, &sampler->previous, NULL);
+	activeSampler = NULL;
+	sampledInstruction = NULL;
+}
+
+typedef struct SampleEntry
+{
+	uint32_t line;
+	uint8_t op;
+} SampleEntry;
+
+int compareSampleEntries(const void* a, const void* b)
+{
+	const SampleEntry* x = (const SampleEntry*)a;
+	const SampleEntry* y = (const SampleEntry*)b;
+	if(x->line != y->line)
+		return x->line < y->line ? -1 : 1;
+	return (int)x->op - (int)y->op;
+}
+
+// writes one folded stack for every line and opcode that was sampled, name is the first frame.
+void writeSamples(FILE* f, Sampler* sampler, const char* name)
+{
+	Chunk* chunk = sampler->chunk;
+	SampleEntry* entries = (SampleEntry*)reallocate(&heapAllocator, NULL, 0, (sampler->count + 1) * sizeof(SampleEntry));
+	for(size_t i = 0; i < sampler->count; i++)
+	{
+		entries[i].line = getLine(&chunk->lines, sampler->offsets[i]);
+		entries[i].op = chunk->data[sampler->offsets[i]];
+	}
+	qsort(entries, sampler->count, sizeof(SampleEntry), compareSampleEntries);
+
+	for(size_t i = 0; i < sampler->count; i++)
+	{
+		uint64_t samples = 1;
+		for(; i + 1 < sampler->count && !compareSampleEntries(&entries[i], &entries[i + 1]); i++)
+			samples++;
+		fprintf(f, "%s;line %u;%s %llu\n", name, entries[i].line, opCodeName(entries[i].op), (unsigned long long)samples);
+	}
+	if(sampler->missed)
+		fprintf(f, "%s;[outside the vm] %llu\n", name, (unsigned long long)sampler->missed);
+
+	reallocate(&heapAllocator, entries, (sampler->count + 1) * sizeof(SampleEntry), 0);
+}
+
+bool writeSamplesFile(Sampler* sampler, const char* name, const char* path)
+{
+	FILE* f = fopen(path, "w");
+	if(f == NULL)
+	{
+		fprintf(stderr, "could not open file: \"%s\".\n", path);
+		return false;
+	}
+
+	writeSamples(f, sampler, name);
+	bool failed = ferror(f);
+	if(fclose(f) || failed)
+	{
+		fprintf(stderr, "could not write file: \"%s\".\n", path);
+		return false;
+	}
+	return true;
+}
+
+#endif
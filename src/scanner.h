@@ -3,6 +3,18 @@
 // todo: more keywords
 // todo: string interpolation
 
+// runLength() reads whole aligned blocks past the '\0', which the hardware allows but AddressSanitizer
+// reports, so sanitized builds use the scalar loop.
+#if defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define SCANNER_SANITIZED
+#endif
+#endif
+#if defined(__SSE2__) && !defined(__SANITIZE_ADDRESS__) && !defined(SCANNER_SANITIZED)
+#define SCANNER_SSE2
+#include <emmintrin.h>
+#endif
+
 typedef struct Scanner 
 {
     const char* start;
@@ -118,6 +130,7 @@ char doublePeek(Scanner* sc)
     return sc->current[1];
 }
 
+// a tab is four collumns, like in skipWhiteSpace().
 char skip(Scanner* sc)
 {
     char c = advance(sc);
@@ -128,8 +141,86 @@ char skip(Scanner* sc)
     }
     else if(c == '\t')
     {
-        sc->line += 3;
+        sc->collumn += 3;
+    }
+    return c;
+}
+
+// runs of characters that only move the collumn by one each, found 16 bytes at a time with sse2.
+// every run also ends at the '\0' at the end of the source.
+typedef enum RunType
+{
+    RUN_SPACES, // ' ' and '\r'.
+    RUN_LINE, // anything but '\n'.
+    RUN_DIGITS,
+    RUN_TEXT, // anything but '\n', '\t' and the end character.
+} RunType;
+
+bool endsRun(char c, RunType type, char end)
+{
+    switch(type)
+    {
+        case RUN_SPACES: return c != ' ' && c != '\r';
+        case RUN_LINE  : return c == '\n' || c == '\0';
+        case RUN_DIGITS: return c < '0' || c > '9';
+        default        : return c == end || c == '\n' || c == '\t' || c == '\0';
+    }
+}
+
+#ifdef SCANNER_SSE2
+// bit i is set when byte i of block ends the run.
+unsigned int runEndMask(__m128i block, RunType type, char end)
+{
+    switch(type)
+    {
+        case RUN_SPACES:
+            return ~_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(block, _mm_set1_epi8('\r')))) & 0xffff;
+        case RUN_LINE:
+            return _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8('\n')), _mm_cmpeq_epi8(block, _mm_setzero_si128())));
+        case RUN_DIGITS:
+        {
+            // digits are the bytes that are at most 9 after subtracting '0'.
+            __m128i digit = _mm_sub_epi8(block, _mm_set1_epi8('0'));
+            return ~_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(digit, _mm_set1_epi8(9)), digit)) & 0xffff;
+        }
+        default:
+            return _mm_movemask_epi8(_mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8(end)), _mm_cmpeq_epi8(block, _mm_set1_epi8('\n'))),
+                _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8('\t')), _mm_cmpeq_epi8(block, _mm_setzero_si128()))));
+    }
+}
+#endif
+
+// length of the run starting at p.
+size_t runLength(const char* p, RunType type, char end)
+{
+#ifdef SCANNER_SSE2
+    // aligned loads never cross into the next page, so reading past the '\0' is safe.
+    size_t misalignment = (uintptr_t)p & 15;
+    const __m128i* block = (const __m128i*)(p - misalignment);
+    unsigned int mask = runEndMask(_mm_load_si128(block), type, end) >> misalignment;
+    if(mask)
+        return __builtin_ctz(mask);
+
+    for(size_t length = 16 - misalignment; ; length += 16)
+    {
+        mask = runEndMask(_mm_load_si128(++block), type, end);
+        if(mask)
+            return length + __builtin_ctz(mask);
     }
+#else
+    const char* start = p;
+    while(!endsRun(*p, type, end))
+        p++;
+    return p - start;
+#endif
+}
+
+void skipRun(Scanner* sc, RunType type, char end)
+{
+    size_t length = runLength(sc->current, type, end);
+    sc->current += length;
+    sc->collumn += length;
 }
 
 void skipWhiteSpace(Scanner* sc)
@@ -150,16 +241,24 @@ void skipWhiteSpace(Scanner* sc)
                 break;
             case ' ':
             case '\r':
-                advance(sc);
+                skipRun(sc, RUN_SPACES, '\0');
                 break;
             case '/':
                 if(doublePeek(sc) == '/')
-                    while(!atEnd(sc) && peek(sc) != '\n')
-                        advance(sc);
+                    skipRun(sc, RUN_LINE, '\0');
                 else if(doublePeek(sc) == '*')
                 {
-                    while(!atEnd(sc) && (peek(sc) != '*' || doublePeek(sc) != '/'))
+                    advance(sc);
+                    advance(sc);
+                    while(true)
+                    {
+                        skipRun(sc, RUN_TEXT, '*');
+                        if(atEnd(sc))
+                            return;
+                        if(peek(sc) == '*' && doublePeek(sc) == '/')
+                            break;
                         skip(sc);
+                    }
                     advance(sc);
                     advance(sc);
                 }
@@ -174,10 +273,13 @@ void skipWhiteSpace(Scanner* sc)
 
 Token string(Scanner* sc, char end)
 {
-    while(peek(sc) != end)
+    while(true)
     {
+        skipRun(sc, RUN_TEXT, end);
         if(atEnd(sc))
             return errorToken(sc, "Unterminated string.");
+        if(peek(sc) == end)
+            break;
         skip(sc);
     }
 
@@ -192,20 +294,32 @@ bool isDigit(char c)
 
 bool isAlpha(char c)
 {
-    return (c >= 'a' && c >= 'z') || (c >= 'A' && c >= 'Z') || c == '_';
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
 }
 
 Token scanNumber(Scanner* sc)
 {
-    while(isDigit(peek(sc)))
-        advance(sc);
+    skipRun(sc, RUN_DIGITS, '\0');
     
     if(peek(sc) == '.' && isDigit(doublePeek(sc)))
     {
         advance(sc);
-        
-        while(isDigit(peek(sc)))
-            advance(sc);
+        skipRun(sc, RUN_DIGITS, '\0');
+    }
+
+    // exponent, only when digits follow, so 2e is 2 followed by e.
+    if(peek(sc) == 'e' || peek(sc) == 'E')
+    {
+        const char* digits = sc->current + 1;
+        if(*digits == '+' || *digits == '-')
+            digits++;
+
+        if(isDigit(*digits))
+        {
+            sc->collumn += digits - sc->current;
+            sc->current = digits;
+            skipRun(sc, RUN_DIGITS, '\0');
+        }
     }
 
     return makeToken(sc, TOKEN_NUMBER);
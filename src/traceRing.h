@@ -0,0 +1,222 @@
+#ifndef TRACE_RING_H
+#define TRACE_RING_H
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+#include "bytecode.h"
+#include "disassembler.h"
+
+// binary execution trace, a few stores per instruction instead of the text of --trace.
+// runRecorded() in vm.h writes a record for every instruction into a ring of the last TRACE_RING_SIZE,
+// which is dumped to a file when the run ends or the process dies of a signal. the file holds the chunk
+// as a bytecode image, so decodeTraceFile() can disassemble the records without the source:
+// header, bytecode image, records (8 byte aligned, in ring order).
+
+#define TRACE_MAGIC 0x54534843 // "CHST"
+#define TRACE_VERSION 1
+#define TRACE_RING_SIZE 4096 // a power of two.
+
+typedef struct TraceHeader
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t reserved;
+	uint32_t capacity; // records in the ring.
+	uint32_t imageSize;
+	uint64_t count; // instructions recorded, the ring holds the last min(count, capacity).
+} TraceHeader;
+
+// the state before an instruction ran.
+typedef struct TraceRecord
+{
+	Value top; // 0 when the stack is empty.
+	uint32_t offset;
+	uint16_t depth; // stack depth, saturated at UINT16_MAX.
+	uint8_t op;
+	uint8_t reserved;
+} TraceRecord;
+
+typedef struct TraceRing
+{
+	TraceRecord* records;
+	uint64_t count;
+
+	// the file is opened and the image written before the run, so dumping is two pwrite() calls.
+	FILE* file;
+	int fd; // of file, fileno() is not async signal safe.
+	TraceHeader header;
+	size_t recordOffset;
+} TraceRing;
+
+// the ring that is dumped by the fatal signal handler.
+TraceRing* volatile activeTraceRing = NULL;
+
+size_t traceRecordOffset(uint32_t imageSize)
+{
+	return (sizeof(TraceHeader) + imageSize + 7) & ~(size_t)7;
+}
+
+// only async signal safe calls, it also runs from the signal handler.
+bool dumpTraceRing(TraceRing* ring)
+{
+	TraceHeader header = ring->header;
+	header.count = ring->count;
+	size_t size = TRACE_RING_SIZE * sizeof(TraceRecord);
+	return pwrite(ring->fd, ring->records, size, ring->recordOffset) == (ssize_t)size &&
+		pwrite(ring->fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header);
+}
+
+void traceSignal(int signal)
+{
+	TraceRing* ring = activeTraceRing;
+	if(ring)
+		dumpTraceRing(ring);
+	activeTraceRing = NULL;
+
+	// die of the signal like without the handler.
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, signal);
+	sigprocmask(SIG_UNBLOCK, &signals, NULL);
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = SIG_DFL;
+	sigaction(signal, &action, NULL);
+	raise(signal);
+}
+
+const int traceSignals[] = { SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT, SIGINT, SIGTERM };
+
+void initTraceRing(TraceRing* ring)
+{
+	ring->records = NULL;
+	ring->count = 0;
+	ring->file = NULL;
+	ring->fd = -1;
+	ring->recordOffset = 0;
+}
+
+// creates the file at path with the image of chunk, and installs the signal handlers.
+bool openTraceRing(TraceRing* ring, Chunk* chunk, const char* path)
+{
+	ring->file = fopen(path, "w+b");
+	if(ring->file == NULL)
+	{
+		fprintf(stderr, "could not open file: \"%s\".\n", path);
+		return false;
+	}
+	ring->fd = fileno(ring->file);
+
+	BytecodeHeader image;
+	makeBytecodeHeader(chunk, &image);
+	memset(&ring->header, 0, sizeof(TraceHeader));
+	ring->header.magic = TRACE_MAGIC;
+	ring->header.version = TRACE_VERSION;
+	ring->header.capacity = TRACE_RING_SIZE;
+	ring->header.imageSize = (uint32_t)bytecodeFileSize(&image);
+	ring->recordOffset = traceRecordOffset(ring->header.imageSize);
+
+	if(fwrite(&ring->header, sizeof(TraceHeader), 1, ring->file) != 1 || !writeBytecode(chunk, ring->file) || fflush(ring->file))
+	{
+		fprintf(stderr, "could not write file: \"%s\".\n", path);
+		fclose(ring->file);
+		ring->file = NULL;
+		return false;
+	}
+
+	ring->records = (TraceRecord*)reallocate(&heapAllocator, NULL, 0, TRACE_RING_SIZE * sizeof(TraceRecord));
+	memset(ring->records, 0, TRACE_RING_SIZE * sizeof(TraceRecord));
+	ring->count = 0;
+	activeTraceRing = ring;
+
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = traceSignal;
+	sigemptyset(&action.sa_mask);
+	for(size_t i = 0; i < sizeof(traceSignals) / sizeof(int); i++)
+		sigaction(traceSignals[i], &action, NULL);
+	return true;
+}
+
+// dumps the ring, restores the signal handlers and closes the file.
+bool closeTraceRing(TraceRing* ring)
+{
+	if(!ring->file)
+		return false;
+
+	activeTraceRing = NULL;
+	for(size_t i = 0; i < sizeof(traceSignals) / sizeof(int); i++)
+		signal(traceSignals[i], SIG_DFL);
+
+	bool written = dumpTraceRing(ring);
+	if(fclose(ring->file))
+		written = false;
+	ring->file = NULL;
+	reallocate(&heapAllocator, ring->records, TRACE_RING_SIZE * sizeof(TraceRecord), 0);
+	ring->records = NULL;
+	return written;
+}
+
+// writes the records of a trace file from the oldest to the newest, with their disassembly.
+bool decodeTraceFile(OutputBuffer* out, const char* path)
+{
+	int fd = open(path, O_RDONLY);
+	if(fd < 0)
+	{
+		fprintf(stderr, "could not open file: \"%s\".\n", path);
+		return false;
+	}
+
+	struct stat st;
+	void* file = MAP_FAILED;
+	if(!fstat(fd, &st) && st.st_size > 0)
+		file = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(file == MAP_FAILED)
+	{
+		fprintf(stderr, "could not read file: \"%s\".\n", path);
+		return false;
+	}
+
+	TraceHeader* header = (TraceHeader*)file;
+	Chunk chunk;
+	initChunk(&chunk);
+	if((size_t)st.st_size < sizeof(TraceHeader) || header->magic != TRACE_MAGIC || header->version != TRACE_VERSION ||
+	   header->capacity == 0 || (header->capacity & (header->capacity - 1)) ||
+	   traceRecordOffset(header->imageSize) + header->capacity * sizeof(TraceRecord) != (size_t)st.st_size ||
+	   !readBytecode(&chunk, (uint8_t*)file + sizeof(TraceHeader), header->imageSize))
+	{
+		fprintf(stderr, "not a valid trace file: \"%s\".\n", path);
+		munmap(file, st.st_size);
+		return false;
+	}
+
+	TraceRecord* records = (TraceRecord*)((uint8_t*)file + traceRecordOffset(header->imageSize));
+	uint64_t first = header->count > header->capacity ? header->count - header->capacity : 0;
+	writeFormat(out, "==== trace: %llu instructions, the last %llu ====\n", (unsigned long long)header->count,
+		(unsigned long long)(header->count - first));
+	writeFormat(out, "%-10s %5s %-24s %s\n", "#", "depth", "top", "instruction");
+
+	for(uint64_t i = first; i < header->count; i++)
+	{
+		TraceRecord* record = &records[i & (header->capacity - 1)];
+		char top[NUMBER_FORMAT_MAX + 1] = "";
+		if(record->depth)
+			top[formatNumber(top, record->top)] = '\0';
+		writeFormat(out, "%-10llu %5u %-24s ", (unsigned long long)i, record->depth, top);
+
+		if(record->offset >= chunk.size || chunk.data[record->offset] != record->op)
+			writeFormat(out, "%04u not in the chunk, opCode: %u\n", record->offset, record->op);
+		else if(chunk.type == CHUNK_REGISTER)
+			disassembleRegisterInstruction(out, &chunk, (int)record->offset);
+		else
+			disassembleInstruction(out, &chunk, (int)record->offset);
+	}
+	writeString(out, "================================\n");
+
+	munmap(file, st.st_size);
+	return true;
+}
+
+#endif
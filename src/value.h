@@ -1,11 +1,20 @@
 #ifndef VALUE_H
 #define VALUE_H
+#include "buffer.h"
+#include "number.h"
 
 typedef double Value;
 
 void printValue(Value v)
 {
-	printf("%g", v);
+	char text[NUMBER_FORMAT_MAX];
+	fwrite(text, 1, formatNumber(text, v), stdout);
 }
 
-#endif
\ No newline at end of file
+void writeValue(OutputBuffer* out, Value v)
+{
+	reserveOutputBuffer(out, NUMBER_FORMAT_MAX);
+	out->size += formatNumber(out->data + out->size, v);
+}
+
+#endif
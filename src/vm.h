@@ -2,36 +2,77 @@
 #define VM_H
 #include "chunk.h"
 #include "disassembler.h"
+#include "profile.h"
+#include "sampler.h"
+#include "traceRing.h"
 #include "common.h"
 
-#define DEBUG_TRACE_EXECUTION
-#define DEBUG_TRACE_STACK
-// dynamic stack size?
-#define STACK_MAX 1024
+// use computed goto (gcc, clang) to give every opcode its own indirect branch.
+// compile with -DNO_THREADED_DISPATCH to use the portable switch instead.
+#if defined(__GNUC__) && !defined(NO_THREADED_DISPATCH)
+#define THREADED_DISPATCH
+#endif
 
 typedef struct VM
 {
 	Chunk* chunk;
 	uint8_t* ip;
 
-	Value stack[STACK_MAX];
+	Value* stack; // big enough for the loaded chunk, so push() and pop() do not check.
+	size_t stackCapacity;
 	Value* stackTop;
+	Value* inputs; // the row OP_INPUT reads from, see columns.h for whole columns.
+
+	OutputBuffer out; // results, written to stdout.
+	OutputBuffer* trace; // only used by runTraced().
+	Profile* profile; // only used by runProfiled().
+	Sampler* sampler; // only used by runSampled().
+	TraceRing* ring; // only used by runRecorded().
 } VM;
 
 void initVM(VM* vm)
+{
+	vm->stack = NULL;
+	vm->stackCapacity = 0;
+	vm->stackTop = vm->stack;
+	vm->inputs = NULL;
+	initOutputBuffer(&vm->out, stdout, OUTPUT_BUFFER_SIZE);
+	vm->trace = NULL;
+	vm->profile = NULL;
+	vm->sampler = NULL;
+	vm->ring = NULL;
+}
+
+// prepares the vm for the next chunk, buffered results are kept.
+void resetVM(VM* vm)
 {
 	vm->stackTop = vm->stack;
 }
 
+// grows the stack to the depth the chunk needs, the stack is never grown while running.
 void loadChunk(VM* vm, Chunk* chunk)
 {
 	vm->chunk = chunk;
 	vm->ip = chunk->data;
+
+	size_t used = vm->stackTop - vm->stack;
+	size_t needed = used + chunk->maxStack;
+	if(needed <= vm->stackCapacity)
+		return;
+
+	if(!(vm->stack = (Value*)realloc(vm->stack, needed * sizeof(Value))))
+	{
+		fprintf(stderr, "memory allocation failed!\n");
+		exit(74);
+	}
+	vm->stackCapacity = needed;
+	vm->stackTop = vm->stack + used;
 }
 
 void freeVM(VM* vm)
 {
-	
+	freeOutputBuffer(&vm->out);
+	free(vm->stack);
 }
 
 void push(VM* vm, Value v)
@@ -46,72 +87,177 @@ Value pop(VM* vm)
 	return *vm->stackTop; 
 }
 
-void printStack(VM* vm)
+void traceStack(VM* vm)
 {
-	printf("[ ");
+	writeString(vm->trace, "stack: [ ");
 	for(Value* v = vm->stack; v < vm->stackTop; v++)
 	{
-		printf("[ ");
-		printValue(*v);
-		printf(" ]");
+		writeString(vm->trace, "[ ");
+		writeValue(vm->trace, *v);
+		writeString(vm->trace, " ]");
 	}
-	printf(" ]");
+	writeString(vm->trace, " ]\n");
 }
 
+void traceInstruction(VM* vm)
+{
+	traceStack(vm);
+	disassembleInstruction(vm->trace, vm->chunk, (int)(vm->ip - vm->chunk->data));
+}
+
+// a macro so it is inlined in every dispatch, the record is built in a local first, so the
+// byte stores do not make the compiler reload the vm.
+#define RECORD_INSTRUCTION(vm) { \
+		TraceRing* ring = vm->ring; \
+		uint8_t* ip = vm->ip; \
+		Value* top = vm->stackTop; \
+		size_t depth = top - vm->stack; \
+		TraceRecord record = { depth ? top[-1] : 0, (uint32_t)(ip - vm->chunk->data), depth < UINT16_MAX ? (uint16_t)depth : UINT16_MAX, *ip, 0 }; \
+		ring->records[ring->count++ & (TRACE_RING_SIZE - 1)] = record; \
+	}
+
 #define BINARY_OP(op) { \
 		Value b = pop(vm); \
 		Value a = pop(vm); \
 		push(vm, a op b); \
 	}
 
+#define CONSTANT_OP(op) { \
+		Value b = vm->chunk->values.data[*vm->ip++]; \
+		Value a = pop(vm); \
+		push(vm, a op b); \
+	}
+
+
+#ifdef THREADED_DISPATCH
+#define CASE(op) label_##op
+#define DISPATCH() { RUN_HOOK(vm); goto *dispatchTable[*vm->ip++]; }
+#else
+#define CASE(op) case op
+#define DISPATCH() break
+#endif
+
+#define RUN_NAME run
+#define RUN_HOOK(vm)
+#include "vmRun.h"
+
+// same loop, but every instruction and the stack are written to vm->trace.
+#define RUN_NAME runTraced
+#define RUN_HOOK(vm) traceInstruction(vm)
+#include "vmRun.h"
 
-Result run(VM* vm)
+// same loop, but the time of every instruction is added to vm->profile.
+#define RUN_NAME runProfiledLoop
+#define RUN_HOOK(vm) profileInstruction(vm->profile, vm->ip)
+#include "vmRun.h"
+
+Result runProfiled(VM* vm)
+{
+	startProfile(vm->profile, vm->chunk);
+	Result r = runProfiledLoop(vm);
+	profileInstruction(vm->profile, NULL);
+	return r;
+}
+
+// same loop, but every instruction publishes its ip for the SIGPROF handler in sampler.h.
+// a store per instruction instead of the clock reads of runProfiled().
+#define RUN_NAME runSampledLoop
+#define RUN_HOOK(vm) sampledInstruction = vm->ip
+#include "vmRun.h"
+
+Result runSampled(VM* vm)
+{
+	if(!startSampler(vm->sampler, vm->chunk))
+		return run(vm);
+	Result r = runSampledLoop(vm);
+	stopSampler(vm->sampler);
+	return r;
+}
+
+// same loop, but every instruction is recorded in vm->ring, see traceRing.h.
+#define RUN_NAME runRecorded
+#define RUN_HOOK(vm) RECORD_INSTRUCTION(vm)
+#include "vmRun.h"
+
+#define READ_REGISTER() (*vm->ip++)
+#define READ_SHORT() (vm->ip += 2, (uint16_t)(vm->ip[-2] | vm->ip[-1] << 8))
+#define READ_OPERAND() (operand = READ_SHORT(), operand & RK_CONSTANT ? constants[operand & ~RK_CONSTANT] : registers[operand])
+#define REGISTER_BINARY_OP(op) { \
+		uint8_t destination = READ_REGISTER(); \
+		Value a = READ_OPERAND(); \
+		Value b = READ_OPERAND(); \
+		registers[destination] = a op b; \
+	}
+
+// executes CHUNK_REGISTER chunks, the vm stack is used as the register file.
+#define RUN_HOOK(vm)
+Result runRegisters(VM* vm)
 {
+	Value* registers = vm->stack;
+	Value* constants = vm->chunk->values.data;
+	uint16_t operand;
+
+#ifdef THREADED_DISPATCH
+	static void* dispatchTable[] = {
+		[ROP_RETURN]   = &&CASE(ROP_RETURN),
+		[ROP_LOAD]     = &&CASE(ROP_LOAD),
+		[ROP_NEGATE]   = &&CASE(ROP_NEGATE),
+		[ROP_ADD]      = &&CASE(ROP_ADD),
+		[ROP_SUBTRACT] = &&CASE(ROP_SUBTRACT),
+		[ROP_MULTIPLY] = &&CASE(ROP_MULTIPLY),
+		[ROP_DIVIDE]   = &&CASE(ROP_DIVIDE),
+	};
+
+	DISPATCH();
+#else
 	while (true)
 	{
-	#ifdef DEBUG_TRACE_STACK
-		printf("stack: ");
-		printStack(vm);
-		printf("\n");
-	#endif
-	#ifdef DEBUG_TRACE_EXECUTION
-		disassembleInstruction(vm->chunk, (int)(vm->ip - vm->chunk->data));
-	#endif
 		switch (*vm->ip++)
+#endif
 		{
-		case OP_RETURN:
-			printValue(pop(vm));
-			printf("\n");
+		CASE(ROP_RETURN):
+			writeValue(&vm->out, READ_OPERAND());
+			writeChar(&vm->out, '\n');
 			return RESULT_OK;
-		case OP_CONSTANT:
-			push(vm, vm->chunk->values.data[*vm->ip++]);
-			break;
-		case OP_LONG_CONSTANT:
-			push(vm, vm->chunk->values.data[*vm->ip++ * 0xff + *vm->ip++]);
-			break;
-		case OP_NEGATE:
-			push(vm, -pop(vm));
-			break;
-		case OP_ADD:
-			BINARY_OP(+)
-			break;
-		case OP_SUBTRACT:
-			BINARY_OP(-)
-			break;
-		case OP_MULTIPLY:
-			BINARY_OP(*)
-			break;
-		case OP_DIVIDE:
-			BINARY_OP(/)
-			break;
+		CASE(ROP_LOAD):
+		{
+			uint8_t destination = READ_REGISTER();
+			registers[destination] = constants[READ_SHORT()];
+			DISPATCH();
+		}
+		CASE(ROP_NEGATE):
+		{
+			uint8_t destination = READ_REGISTER();
+			registers[destination] = -READ_OPERAND();
+			DISPATCH();
 		}
-	}	
+		CASE(ROP_ADD):
+			REGISTER_BINARY_OP(+)
+			DISPATCH();
+		CASE(ROP_SUBTRACT):
+			REGISTER_BINARY_OP(-)
+			DISPATCH();
+		CASE(ROP_MULTIPLY):
+			REGISTER_BINARY_OP(*)
+			DISPATCH();
+		CASE(ROP_DIVIDE):
+			REGISTER_BINARY_OP(/)
+			DISPATCH();
+		}
+#ifndef THREADED_DISPATCH
+	}
+#endif
 }
+#undef RUN_HOOK
+
+#undef CASE
+#undef DISPATCH
 
 Result execute(VM* vm, Chunk* chunk)
 {
-	vm->chunk = chunk;
-	vm->ip = chunk->data;
+	loadChunk(vm, chunk);
+	if(chunk->type == CHUNK_REGISTER)
+		return runRegisters(vm);
 	return run(vm);
 }
 
@@ -0,0 +1,87 @@
+// the interpreter loop, included by vm.h once for every variant of run().
+// the includer defines RUN_NAME, the name of the function, and RUN_HOOK(vm),
+// which is executed before every instruction and expands to nothing in the release loop.
+// no include guard on purpose.
+
+Result RUN_NAME(VM* vm)
+{
+#ifdef THREADED_DISPATCH
+	static void* dispatchTable[] = {
+		[OP_RETURN]        = &&CASE(OP_RETURN),
+		[OP_CONSTANT]      = &&CASE(OP_CONSTANT),
+		[OP_LONG_CONSTANT] = &&CASE(OP_LONG_CONSTANT),
+		[OP_NEGATE]        = &&CASE(OP_NEGATE),
+		[OP_ADD]           = &&CASE(OP_ADD),
+		[OP_SUBTRACT]      = &&CASE(OP_SUBTRACT),
+		[OP_MULTIPLY]      = &&CASE(OP_MULTIPLY),
+		[OP_DIVIDE]        = &&CASE(OP_DIVIDE),
+
+		[OP_ADD_CONSTANT]      = &&CASE(OP_ADD_CONSTANT),
+		[OP_SUBTRACT_CONSTANT] = &&CASE(OP_SUBTRACT_CONSTANT),
+		[OP_MULTIPLY_CONSTANT] = &&CASE(OP_MULTIPLY_CONSTANT),
+		[OP_DIVIDE_CONSTANT]   = &&CASE(OP_DIVIDE_CONSTANT),
+		[OP_CONSTANT_CONSTANT] = &&CASE(OP_CONSTANT_CONSTANT),
+		[OP_INPUT]             = &&CASE(OP_INPUT),
+	};
+
+	DISPATCH();
+#else
+	while (true)
+	{
+		RUN_HOOK(vm);
+		switch (*vm->ip++)
+#endif
+		{
+		CASE(OP_RETURN):
+			writeValue(&vm->out, pop(vm));
+			writeChar(&vm->out, '\n');
+			return RESULT_OK;
+		CASE(OP_CONSTANT):
+			push(vm, vm->chunk->values.data[*vm->ip++]);
+			DISPATCH();
+		CASE(OP_LONG_CONSTANT):
+			vm->ip += 2;
+			push(vm, vm->chunk->values.data[vm->ip[-2] | vm->ip[-1] << 8]);
+			DISPATCH();
+		CASE(OP_NEGATE):
+			push(vm, -pop(vm));
+			DISPATCH();
+		CASE(OP_ADD):
+			BINARY_OP(+)
+			DISPATCH();
+		CASE(OP_SUBTRACT):
+			BINARY_OP(-)
+			DISPATCH();
+		CASE(OP_MULTIPLY):
+			BINARY_OP(*)
+			DISPATCH();
+		CASE(OP_DIVIDE):
+			BINARY_OP(/)
+			DISPATCH();
+		CASE(OP_ADD_CONSTANT):
+			CONSTANT_OP(+)
+			DISPATCH();
+		CASE(OP_SUBTRACT_CONSTANT):
+			CONSTANT_OP(-)
+			DISPATCH();
+		CASE(OP_MULTIPLY_CONSTANT):
+			CONSTANT_OP(*)
+			DISPATCH();
+		CASE(OP_DIVIDE_CONSTANT):
+			CONSTANT_OP(/)
+			DISPATCH();
+		CASE(OP_CONSTANT_CONSTANT):
+			push(vm, vm->chunk->values.data[*vm->ip++]);
+			push(vm, vm->chunk->values.data[*vm->ip++]);
+			DISPATCH();
+		CASE(OP_INPUT):
+			push(vm, vm->inputs[*vm->ip++]);
+			DISPATCH();
+		}
+#ifndef THREADED_DISPATCH
+	}
+#endif
+}
+
+#undef RUN_NAME
+#undef RUN_HOOK
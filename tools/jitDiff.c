@@ -0,0 +1,179 @@
+// runs a corpus of expressions with the jit and with the interpreter and compares the results bit for bit,
+// for every row of a set of inputs. the corpus is a fixed list of edge cases (long NEGATE chains, -0, NaN,
+// infinities, the deepest stack the jit takes) and count random expressions.
+//   gcc -O2 -o jitDiff tools/jitDiff.c -lm
+//   ./jitDiff [count] [seed]
+// exits with 1 if any result differs.
+// two NaNs count as the same: which operand's NaN an operation returns is not specified, and the c
+// compiler may swap the operands of + and * in the interpreter. -0 and 0 are different.
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../src/jit.h"
+#include "../src/compiler.h"
+
+#define COUNT 20000
+
+const char* inputNames[] = { "x", "y", "z" };
+
+Value rows[][3] = {
+	{ 1.5, -2, 3.25 },
+	{ 0.0, -0.0, 1 },
+	{ -0.0, -0.0, -0.0 },
+	{ NAN, -NAN, 2 },
+	{ INFINITY, -INFINITY, 0.0 },
+	{ 5e-324, -1e308, 1e308 },
+};
+#define ROW_COUNT (sizeof(rows) / sizeof(rows[0]))
+
+const char* edgeCases[] = {
+	"-x", "--x", "---y", "-0", "-(0)", "0 * -1", "-x * 0", "x - x", "y + 0", "-y - 0",
+	"0/0", "-(0/0)", "x/0", "-x/0", "0/x", "x/y/z", "1/0 - 1/0", "(x - x)/(y - y)",
+	"1e308 * 10 * x", "-z * -z", "x * y - z", "-(x + y) * -(y + z) / -(z + x)",
+};
+
+// x + (y + (x + ...)), needs depth + 1 stack slots.
+void writeDeep(OutputBuffer* out, int depth)
+{
+	for(int i = 0; i < depth; i++)
+		writeString(out, i % 2 ? "(y + " : "(x - ");
+	writeString(out, "z");
+	for(int i = 0; i < depth; i++)
+		writeChar(out, ')');
+}
+
+void writeNegations(OutputBuffer* out, int count)
+{
+	for(int i = 0; i < count; i++)
+		writeChar(out, '-');
+	writeString(out, "x");
+}
+
+void writeRandom(OutputBuffer* out, int depth)
+{
+	static const char* leaves[] = { "x", "y", "z", "0", "1", "2.5", "1e308", "5e-324", "0.1" };
+	static const char* operators[] = { " + ", " - ", " * ", " / " };
+	int r = rand() % 10;
+
+	if(depth > 6 || r < 3)
+		writeString(out, leaves[rand() % (sizeof(leaves) / sizeof(leaves[0]))]);
+	else if(r < 5)
+	{
+		writeChar(out, '-');
+		writeRandom(out, depth + 1);
+	}
+	else
+	{
+		writeChar(out, '(');
+		writeRandom(out, depth + 1);
+		writeString(out, operators[rand() % 4]);
+		writeRandom(out, depth + 1);
+		writeChar(out, ')');
+	}
+}
+
+// the value run() returned, OP_RETURN pops it but leaves it in its slot.
+Value interpret(VM* vm, Chunk* chunk, Value* inputs)
+{
+	resetVM(vm);
+	vm->out.size = 0;
+	vm->inputs = inputs;
+	loadChunk(vm, chunk);
+	run(vm);
+	return *vm->stackTop;
+}
+
+// compiles source and compares both ways of running it on every row, returns false if they differ.
+bool check(VM* vm, const char* source, int* translated)
+{
+	Chunk chunk;
+	initChunk(&chunk);
+	OutputBuffer errors;
+	initOutputBuffer(&errors, NULL, 256);
+	Compiler comp;
+	initCompiler(&comp);
+	comp.inputs = inputNames;
+	comp.inputCount = 3;
+	comp.errors = &errors;
+
+	bool same = true;
+	if(compile(&comp, source, &chunk) != RESULT_OK)
+	{
+		fprintf(stderr, "does not compile: %.60s\n%.*s", source, (int)errors.size, errors.data);
+		same = false;
+	}
+	else
+	{
+		JitCode jit;
+		if(compileJit(&jit, &chunk))
+		{
+			(*translated)++;
+			for(size_t row = 0; row < ROW_COUNT && same; row++)
+			{
+				Value expected = interpret(vm, &chunk, rows[row]);
+				Value actual = jit.function(chunk.values.data, rows[row]);
+				if(valueBits(expected) != valueBits(actual) && !(isnan(expected) && isnan(actual)))
+				{
+					fprintf(stderr, "row %zu: interpreter %a, jit %a: %.60s\n", row, expected, actual, source);
+					same = false;
+				}
+			}
+			freeJit(&jit);
+		}
+	}
+
+	freeCompiler(&comp);
+	freeOutputBuffer(&errors);
+	freeChunk(&chunk);
+	return same;
+}
+
+int main(int argc, char const *argv[])
+{
+	int count = argc > 1 ? atoi(argv[1]) : COUNT;
+	srand(argc > 2 ? (unsigned)atoi(argv[2]) : 1);
+
+	VM vm;
+	initVM(&vm);
+	vm.out.file = NULL;
+	OutputBuffer source;
+	initOutputBuffer(&source, NULL, 4096);
+
+	int checked = 0;
+	int failed = 0;
+	int translated = 0;
+
+	for(size_t i = 0; i < sizeof(edgeCases) / sizeof(edgeCases[0]); i++, checked++)
+		failed += !check(&vm, edgeCases[i], &translated);
+
+	// around the length where one NEGATE per bytecode byte fills the code buffer, and the stack limit.
+	int negations[] = { 1, 2, 3, 255, 256, 3000, 3001, 10000 };
+	for(size_t i = 0; i < sizeof(negations) / sizeof(int); i++, checked++)
+	{
+		source.size = 0;
+		writeNegations(&source, negations[i]);
+		writeChar(&source, '\0');
+		failed += !check(&vm, source.data, &translated);
+	}
+	for(int depth = 1; depth <= JIT_STACK_MAX + 1; depth++, checked++)
+	{
+		source.size = 0;
+		writeDeep(&source, depth);
+		writeChar(&source, '\0');
+		failed += !check(&vm, source.data, &translated);
+	}
+
+	for(int i = 0; i < count; i++, checked++)
+	{
+		source.size = 0;
+		writeRandom(&source, 0);
+		writeChar(&source, '\0');
+		failed += !check(&vm, source.data, &translated);
+	}
+
+	printf("expressions: %d | translated: %d | rows: %zu | failed: %d\n", checked, translated, ROW_COUNT, failed);
+	freeOutputBuffer(&source);
+	freeVM(&vm);
+	return failed ? 1 : 0;
+}
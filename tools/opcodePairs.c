@@ -0,0 +1,133 @@
+// counts how often every pair of adjacent opcodes occurs in the compiled chunks of a corpus,
+// to choose which superinstructions are worth adding.
+// chunks have no jumps, so the count in the code is also the number of times a pair is executed.
+// identifiers are inputs, name them with -i, without inputs most files fold to a single constant.
+//   gcc -O2 -o opcodePairs tools/opcodePairs.c
+//   ./opcodePairs [-O] [-i x,y,...] files...
+// files that do not compile are skipped and counted.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../src/vm.h"
+#include "../src/compiler.h"
+#include "../src/optimizer.h"
+
+typedef struct Pair
+{
+	uint8_t first;
+	uint8_t second;
+	uint64_t count;
+} Pair;
+
+char* readFile(const char* path)
+{
+	FILE* f = fopen(path, "rb");
+
+	if(f == NULL)
+	{
+		fprintf(stderr, "could not open file: \"%s\".\n", path);
+		exit(74);
+	}
+
+	fseek(f, 0L, SEEK_END);
+	size_t size = ftell(f);
+	rewind(f);
+
+	char* buffer = (char*)malloc(size + 1);
+	if(!buffer || fread(buffer, sizeof(char), size, f) < size)
+	{
+		fprintf(stderr, "could not read file: \"%s\".\n", path);
+		exit(74);
+	}
+	fclose(f);
+
+	buffer[size] = '\0';
+	return buffer;
+}
+
+int comparePairs(const void* a, const void* b)
+{
+	uint64_t countA = ((const Pair*)a)->count;
+	uint64_t countB = ((const Pair*)b)->count;
+	return countA < countB ? 1 : countA > countB ? -1 : 0;
+}
+
+int main(int argc, char const *argv[])
+{
+	static uint64_t counts[256][256];
+	uint64_t instructions = 0;
+	bool optimize = false;
+	int files = 0;
+	int skipped = 0;
+	const char* inputs[INPUT_MAX];
+	int inputCount = 0;
+	char* names = NULL;
+
+	for(int i = 1; i < argc; i++)
+	{
+		if(!strcmp(argv[i], "-O"))
+		{
+			optimize = true;
+			continue;
+		}
+		if(!strcmp(argv[i], "-i") && i + 1 < argc)
+		{
+			// the names point into a copy of the argument, split at the commas.
+			free(names);
+			names = strdup(argv[++i]);
+			inputCount = 0;
+			for(char* name = strtok(names, ","); name && inputCount < INPUT_MAX; name = strtok(NULL, ","))
+				inputs[inputCount++] = name;
+			continue;
+		}
+
+		char* source = readFile(argv[i]);
+		Chunk chunk;
+		initChunk(&chunk);
+		Compiler comp;
+		initCompiler(&comp);
+		comp.inputs = inputs;
+		comp.inputCount = inputCount;
+
+		if(compile(&comp, source, &chunk) == RESULT_OK)
+		{
+			if(optimize)
+				optimizeChunk(&chunk);
+
+			int previous = -1;
+			for(size_t offset = 0; offset < chunk.size; offset += opCodeSize(chunk.data[offset]))
+			{
+				if(previous >= 0)
+					counts[previous][chunk.data[offset]]++;
+				previous = chunk.data[offset];
+				instructions++;
+			}
+			files++;
+		}
+		else
+			skipped++;
+
+		freeCompiler(&comp);
+		freeChunk(&chunk);
+		free(source);
+	}
+
+	Pair pairs[OP_COUNT * OP_COUNT];
+	int pairCount = 0;
+	uint64_t total = 0;
+	for(int a = 0; a < OP_COUNT; a++)
+		for(int b = 0; b < OP_COUNT; b++)
+			if(counts[a][b])
+			{
+				pairs[pairCount++] = (Pair){ (uint8_t)a, (uint8_t)b, counts[a][b] };
+				total += counts[a][b];
+			}
+
+	qsort(pairs, pairCount, sizeof(Pair), comparePairs);
+
+	printf("files: %d | skipped: %d | instructions: %llu | pairs: %llu\n", files, skipped, (unsigned long long)instructions, (unsigned long long)total);
+	for(int i = 0; i < pairCount; i++)
+		printf("%10llu %6.2f%%  %s %s\n", (unsigned long long)pairs[i].count, 100.0 * pairs[i].count / total, opCodeName(pairs[i].first), opCodeName(pairs[i].second));
+	free(names);
+	return 0;
+}